@@ -0,0 +1,156 @@
+// Builds the synthetic trees the benchmarks run on. The same arguments
+// always give the same tree: names, sizes, mtimes and layout all come
+// from a fixed seed.
+//
+//   bench/gen_tree flat COUNT DIR    COUNT empty files with short names
+//   bench/gen_tree mixed COUNT DIR   COUNT entries with a spread of name
+//                                    lengths (some UTF-8), sparse sizes
+//                                    from 0 to 1G, mtimes over ten years
+//                                    and a few symlinks
+//   bench/gen_tree deep DEPTH DIR    a binary tree of directories DEPTH
+//                                    levels deep, 8 files in each
+//
+// DIR must not exist yet. Once the tree is complete a .gen_tree file in
+// DIR records the arguments, so scripts can tell a finished tree from one
+// cut short.
+
+#include "../ls.hpp"
+
+#include <random>
+
+static std::mt19937 rng(42);
+
+static const char* const stems[] = {
+    "IMG_", "report-final-v", "build.", "README", "module", "a", "test_", "libfoo.so.", "data"
+};
+static const char* const exts[] = {".jpg", ".txt", ".o", ".cpp", "", ".tar.gz", ".log", ".json"};
+static const char* const utf8_parts[] = {
+    "caf\xc3\xa9", "\xc3\xbc" "ber", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xd0\xbf\xd1\x80\xd0\xb8"
+};
+
+template <typename T, std::size_t N>
+static const T& pick(const T (&a)[N])
+{
+    return a[rng() % N];
+}
+
+static void fail(const char* what, const std::string& path)
+{
+    std::fprintf(stderr, "gen_tree: %s %s: %s\n", what, path.c_str(), std::strerror(errno));
+    std::exit(1);
+}
+
+static void make_file(int dirfd, const std::string& name, off_t size, time_t mtime)
+{
+    int fd = openat(dirfd, name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+        fail("create", name);
+    if (size > 0 && ftruncate(fd, size) == -1)
+        fail("truncate", name);
+    if (mtime != 0) {
+        struct timespec ts[2] = {{mtime, 0}, {mtime, 0}};
+        futimens(fd, ts);
+    }
+    close(fd);
+}
+
+// the i-th name, unique within its directory
+static std::string short_name(std::size_t i)
+{
+    return std::string(pick(stems)) + std::to_string(i) + pick(exts);
+}
+
+static void flat(int dirfd, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+        make_file(dirfd, short_name(i), 0, 0);
+}
+
+// most names 8 to 24 bytes, a long tail up to about 200
+static std::string mixed_name(std::size_t i)
+{
+    std::string s = std::to_string(i) + "_";
+    unsigned int roll = rng() % 100;
+    std::size_t len = roll < 80 ? 8 + rng() % 17 : roll < 97 ? 25 + rng() % 60 : 85 + rng() % 115;
+    if (rng() % 10 == 0)
+        s += pick(utf8_parts);
+    while (s.size() < len)
+        s += static_cast<char>('a' + rng() % 26);
+    return s + pick(exts);
+}
+
+static void mixed(int dirfd, std::size_t count)
+{
+    const time_t now = 1700000000;
+    std::string prev;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string name = mixed_name(i);
+        if (i > 0 && rng() % 32 == 0) {
+            if (symlinkat(prev.c_str(), dirfd, name.c_str()) == -1)
+                fail("symlink", name);
+            prev = name;
+            continue;
+        }
+        prev = name;
+        // log-uniform over 0 .. 1G; the files are sparse, so this is free
+        off_t size = rng() % 8 == 0 ? 0 : static_cast<off_t>(std::exp2((rng() % 3000) / 100.0));
+        make_file(dirfd, name, size, now - rng() % (10 * 365 * 86400));
+    }
+}
+
+static std::size_t deep(int dirfd, int depth)
+{
+    std::size_t entries = 0;
+    for (int i = 0; i < 8; ++i, ++entries)
+        make_file(dirfd, short_name(i), rng() % 65536, 0);
+    if (depth <= 1)
+        return entries;
+    for (int i = 0; i < 2; ++i, ++entries) {
+        std::string name = "dir" + std::to_string(i);
+        if (mkdirat(dirfd, name.c_str(), 0755) == -1)
+            fail("mkdir", name);
+        int fd = openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+            fail("open", name);
+        entries += deep(fd, depth - 1);
+        close(fd);
+    }
+    return entries;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4) {
+        std::fprintf(stderr, "usage: gen_tree flat|mixed COUNT DIR\n"
+                             "       gen_tree deep DEPTH DIR\n");
+        return 1;
+    }
+    std::string kind = argv[1], dir = argv[3];
+    unsigned long n = std::strtoul(argv[2], NULL, 10);
+    if (kind != "flat" && kind != "mixed" && kind != "deep") {
+        std::fprintf(stderr, "gen_tree: unknown kind '%s'\n", kind.c_str());
+        return 1;
+    }
+    if (mkdir(dir.c_str(), 0755) == -1)
+        fail("mkdir", dir);
+    int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1)
+        fail("open", dir);
+
+    std::size_t entries = n;
+    if (kind == "flat") {
+        flat(dirfd, n);
+    } else if (kind == "mixed") {
+        mixed(dirfd, n);
+    } else {
+        entries = deep(dirfd, n);
+    }
+
+    std::string done = kind + " " + argv[2] + " entries=" + std::to_string(entries) + "\n";
+    int fd = openat(dirfd, ".gen_tree", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write(fd, done.data(), done.size()) != static_cast<ssize_t>(done.size()))
+        fail("write", dir + "/.gen_tree");
+    close(fd);
+    close(dirfd);
+    return 0;
+}
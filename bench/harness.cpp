@@ -0,0 +1,160 @@
+// Runs one ls command line over a benchmark tree and reports, as a single
+// line of key=value pairs:
+//
+//   wall_ms, wall_ms_median   best and median wall time over RUNS runs
+//   maxrss_kb                 largest peak RSS of those runs
+//   syscalls, syscalls_per_entry
+//                             from one extra run under ptrace, every
+//                             thread included; "na" where ptrace is not
+//                             allowed (some containers and seccomp
+//                             profiles)
+//
+//   bench/harness TREE MODE RUNS DIR LS [ARG...]
+//
+// runs LS ARG... DIR with stdout on /dev/null. TREE and MODE only label
+// the line. The entry count comes from the .gen_tree file gen_tree left
+// in DIR, or is counted from DIR's top level.
+
+#include "../ls.hpp"
+
+#include <chrono>
+#include <set>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+static std::vector<char*> command;
+
+static void exec_command()
+{
+    int null = open("/dev/null", O_WRONLY);
+    if (null == -1 || dup2(null, STDOUT_FILENO) == -1)
+        _exit(127);
+    execv(command[0], command.data());
+    _exit(127);
+}
+
+// one plain run: wall time in ms, peak RSS in KB
+static double timed_run(long& maxrss)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+        exec_command();
+    int status;
+    struct rusage ru;
+    if (pid == -1 || wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::fprintf(stderr, "harness: %s failed\n", command[0]);
+        std::exit(1);
+    }
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+    maxrss = std::max(maxrss, ru.ru_maxrss);
+    return d.count();
+}
+
+// one run under ptrace, counting syscall entries in every thread; -1 if
+// the child could not be traced
+static long traced_run()
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+            _exit(126);
+        raise(SIGSTOP);
+        exec_command();
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    if (!WIFSTOPPED(status))
+        return -1;
+    long opts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, reinterpret_cast<void*>(opts)) == -1) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+
+    long calls = 0;
+    std::set<pid_t> seen, in_syscall;
+    seen.insert(pid);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1)
+            break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid)
+                break;
+            continue;
+        }
+        int sig = WSTOPSIG(status), inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            // entry and exit stops alternate
+            if (in_syscall.erase(tid) == 0) {
+                in_syscall.insert(tid);
+                ++calls;
+            }
+        } else if (status >> 16 != 0) {
+            // clone or exec event
+        } else if (sig == SIGSTOP && seen.count(tid) == 0) {
+            // a new thread's first stop
+            seen.insert(tid);
+        } else {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, reinterpret_cast<void*>(static_cast<long>(inject)));
+    }
+    return calls;
+}
+
+static unsigned long tree_entries(const std::string& dir)
+{
+    FILE* f = std::fopen((dir + "/.gen_tree").c_str(), "r");
+    if (f) {
+        char line[256];
+        const char* p = std::fgets(line, sizeof(line), f) ? std::strstr(line, "entries=") : NULL;
+        std::fclose(f);
+        if (p)
+            return std::strtoul(p + 8, NULL, 10);
+    }
+    unsigned long n = 0;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (struct dirent* e = readdir(d))
+            n += e->d_name[0] != '.';
+        closedir(d);
+    }
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 6) {
+        std::fprintf(stderr, "usage: harness TREE MODE RUNS DIR LS [ARG...]\n");
+        return 1;
+    }
+    int runs = std::max(1, std::atoi(argv[3]));
+    std::string dir = argv[4];
+    for (int i = 5; i < argc; ++i)
+        command.push_back(argv[i]);
+    command.push_back(argv[4]);
+    command.push_back(NULL);
+
+    std::vector<double> wall;
+    long maxrss = 0;
+    timed_run(maxrss);      // warm the dentry and inode caches
+    maxrss = 0;
+    for (int i = 0; i < runs; ++i)
+        wall.push_back(timed_run(maxrss));
+    std::sort(wall.begin(), wall.end());
+    long calls = traced_run();
+    unsigned long entries = tree_entries(dir);
+
+    std::printf("bench=ls tree=%s mode=%s entries=%lu wall_ms=%.2f wall_ms_median=%.2f maxrss_kb=%ld",
+                argv[1], argv[2], entries, wall[0], wall[wall.size() / 2], maxrss);
+    if (calls >= 0)
+        std::printf(" syscalls=%ld syscalls_per_entry=%.4f\n", calls,
+                    entries ? static_cast<double>(calls) / entries : 0.0);
+    else
+        std::printf(" syscalls=na syscalls_per_entry=na\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+# The benchmark suite behind `make bench`: builds the synthetic trees
+# under BENCH_DIR (once; they are kept for later runs), times every mode
+# on them with bench/harness, then runs bench/width_bench. Each
+# measurement is one line of key=value pairs, so the output of two builds
+# can be diffed or joined on tree and mode:
+#
+#   make bench > before.txt
+#   ... change things ...
+#   make bench > after.txt
+#
+# BENCH_DIR defaults to /dev/shm/ls-bench, so the numbers measure ls and
+# not the disk. BENCH_FULL=1 adds the 1M entry directory (about a GB of
+# tmpfs). RUNS is the number of timed runs per line.
+
+LS=${LS:-./ls}
+DIR=${BENCH_DIR:-/dev/shm/ls-bench}
+RUNS=${RUNS:-5}
+
+for tool in "$LS" bench/gen_tree bench/harness bench/width_bench; do
+    if [ ! -x "$tool" ]; then
+        echo "$tool not found, run make bench" >&2
+        exit 1
+    fi
+done
+mkdir -p "$DIR" || exit 1
+
+# tree NAME KIND COUNT: (re)build DIR/NAME unless a finished copy exists
+tree() {
+    if [ "$(cat "$DIR/$1/.gen_tree" 2>/dev/null | cut -d' ' -f1,2)" != "$2 $3" ]; then
+        rm -rf "${DIR:?}/$1"
+        echo "building $DIR/$1" >&2
+        bench/gen_tree "$2" "$3" "$DIR/$1" || exit 1
+    fi
+}
+
+# run TREE MODE [ARG...]
+run() {
+    t=$1
+    m=$2
+    shift 2
+    bench/harness "$t" "$m" "$RUNS" "$DIR/$t" "$LS" "$@" || exit 1
+}
+
+tree flat_1k flat 1000
+tree flat_100k flat 100000
+tree mixed_100k mixed 100000
+tree deep_13 deep 13
+if [ "${BENCH_FULL:-0}" = 1 ]; then
+    tree flat_1m flat 1000000
+fi
+
+echo "build=$(git describe --always --dirty 2>/dev/null || echo unknown) runs=$RUNS dir=$DIR"
+for t in flat_1k flat_100k mixed_100k flat_1m; do
+    [ -d "$DIR/$t" ] || continue
+    run $t short
+    run $t l -l
+    run $t S -S
+    run $t f -f
+done
+run mixed_100k t -t
+run mixed_100k lS -lS
+run deep_13 R -R
+run deep_13 lR -lR
+run deep_13 fR -fR
+run deep_13 R_threads4 -R --threads=4
+
+bench/width_bench 200000 5
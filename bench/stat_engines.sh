@@ -0,0 +1,45 @@
+#!/bin/sh
+# Compare the sync and io_uring stat engines on one synthetic directory.
+#
+#   bench/stat_engines.sh [ENTRIES] [DIR]
+#
+# ENTRIES defaults to 200000, DIR to a fresh directory under $TMPDIR.
+# Point DIR at the filesystem you care about (NFS, CephFS, ...) to see
+# what batching buys there; tmpfs mostly measures the syscall overhead.
+
+LS=${LS:-./ls}
+N=${1:-200000}
+DIR=${2:-${TMPDIR:-/tmp}/ls-bench-statx}
+RUNS=${RUNS:-3}
+
+if [ ! -x "$LS" ]; then
+    echo "$LS not found, run make first" >&2
+    exit 1
+fi
+
+if [ "$(ls -f "$DIR" 2>/dev/null | wc -l)" -ne $((N + 2)) ]; then
+    rm -rf "$DIR"
+    mkdir -p "$DIR" || exit 1
+    (cd "$DIR" && seq -f "entry_%.0f" 1 "$N" | xargs touch) || exit 1
+fi
+
+now() {
+    date +%s%N
+}
+
+for mode in "-l" "-lS" "-f -l"; do
+    for engine in sync uring; do
+        best=
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            start=$(now)
+            $LS $mode --stat-engine=$engine "$DIR" > /dev/null
+            ms=$(( ($(now) - start) / 1000000 ))
+            if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+                best=$ms
+            fi
+            i=$((i + 1))
+        done
+        printf '%-8s %-6s %8d entries %8d ms\n' "$mode" "$engine" "$N" "$best"
+    done
+done
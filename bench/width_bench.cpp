@@ -0,0 +1,98 @@
+// Microbenchmark for display_width() against the libc way of measuring a
+// name (mbrtowc + wcwidth), over a mix of names shaped like real trees:
+// mostly ASCII of every length, with some accented Latin, CJK and emoji.
+//
+//   make width_bench && bench/width_bench [NAMES] [ROUNDS]
+
+#include "../ls.hpp"
+
+#include <chrono>
+#include <clocale>
+#include <cwchar>
+#include <random>
+
+static const char* const ascii_stems[] = {
+    "IMG_", "report-final-v", "build.", "README", "node_modules", "a",
+    "0f3c9e2b7d1a4c5e8f6b0a9d2c3e4f5a6b7c8d9e", "Makefile", "libfoo.so.", "test_"
+};
+static const char* const ascii_exts[] = {".jpg", ".txt", ".o", ".cpp", "", ".tar.gz", ".log"};
+static const char* const utf8_parts[] = {
+    "caf\xc3\xa9", "\xc3\xbc" "ber", "e\xcc\x81", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+    "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4", "\xf0\x9f\x98\x80", "\xd0\xbf\xd1\x80\xd0\xb8"
+};
+
+static std::vector<std::string> make_names(std::size_t n)
+{
+    std::mt19937 rng(42);
+    std::vector<std::string> names(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::string& s = names[i];
+        unsigned int pick = rng() % 100;
+        s = ascii_stems[rng() % (sizeof(ascii_stems) / sizeof(ascii_stems[0]))];
+        s += std::to_string(rng() % 10000);
+        if (pick >= 90)
+            s += utf8_parts[rng() % (sizeof(utf8_parts) / sizeof(utf8_parts[0]))];
+        s += ascii_exts[rng() % (sizeof(ascii_exts) / sizeof(ascii_exts[0]))];
+    }
+    return names;
+}
+
+static int libc_width(const char* s, std::size_t n)
+{
+    std::mbstate_t st;
+    std::memset(&st, 0, sizeof(st));
+    int width = 0;
+    while (n > 0) {
+        wchar_t wc;
+        std::size_t k = std::mbrtowc(&wc, s, n, &st);
+        if (k == static_cast<std::size_t>(-1) || k == static_cast<std::size_t>(-2)) {
+            std::memset(&st, 0, sizeof(st));
+            ++width;
+            k = 1;
+        } else {
+            int w = wcwidth(wc);
+            width += w < 0 ? 1 : w;
+        }
+        s += k;
+        n -= k;
+    }
+    return width;
+}
+
+template <typename F>
+static double ns_per_name(const std::vector<std::string>& names, int rounds, F f, long& sum)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (std::size_t i = 0; i < names.size(); ++i)
+            sum += f(names[i].data(), names[i].size());
+    }
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+    return d.count() / (static_cast<double>(names.size()) * rounds);
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+    if (!std::setlocale(LC_CTYPE, "C.UTF-8")) {
+        std::fprintf(stderr, "width_bench: no C.UTF-8 locale\n");
+        return 1;
+    }
+    std::vector<std::string> names = make_names(n);
+
+    long sum_fast = 0, sum_libc = 0;
+    std::size_t differ = 0;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (display_width(names[i].data(), names[i].size()) != libc_width(names[i].data(), names[i].size()))
+            ++differ;
+    }
+    double fast = ns_per_name(names, rounds, display_width, sum_fast);
+    double libc = ns_per_name(names, rounds, libc_width, sum_libc);
+
+    std::printf("bench=width impl=display_width names=%zu rounds=%d ns_per_name=%.2f total_width=%ld "
+                "widths_differ=%zu\n", n, rounds, fast, sum_fast / rounds, differ);
+    std::printf("bench=width impl=mbrtowc_wcwidth names=%zu rounds=%d ns_per_name=%.2f total_width=%ld\n",
+                n, rounds, libc, sum_libc / rounds);
+    return 0;
+}
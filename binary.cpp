@@ -0,0 +1,73 @@
+#include "ls.hpp"
+#include "lsbin.hpp"
+
+// --format=binary: the stream lsbin.hpp describes. Records are built on
+// the stack and go straight into the writer, with each name's heap offset
+// worked out on the way; the heap follows in a second pass over the
+// table.
+
+static const char zeros[8] = {0};
+
+void binary_header(writer_t& out)
+{
+    lsbin_header_t h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, lsbin_magic, sizeof(lsbin_magic));
+    h.version = lsbin_version;
+    h.byte_order = lsbin_byte_order;
+    h.header_size = sizeof(lsbin_header_t);
+    h.record_size = sizeof(lsbin_record_t);
+    out.put(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+void binary_dir(writer_t& out, const std::string& path)
+{
+    lsbin_segment_t s = {LSBIN_DIR, 0, path.size()};
+    out.put(reinterpret_cast<const char*>(&s), sizeof(s));
+    out.put(path);
+    out.put(zeros, lsbin_pad(path.size()) - path.size());
+}
+
+static int64_t nanoseconds(const struct timespec& ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void binary_print(entry_table_t& files, writer_t& out)
+{
+    fill_stats(files);
+    phase_timer_t timer(PHASE_FORMAT);
+    uint64_t heap = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+        heap += files.name_len[i] + 1;
+    lsbin_segment_t s = {LSBIN_ENTRIES, static_cast<uint32_t>(files.size()), heap};
+    out.put(reinterpret_cast<const char*>(&s), sizeof(s));
+
+    uint64_t off = 0;
+    for (std::size_t k = 0; k < files.size(); ++k) {
+        std::size_t i = files.order[k];
+        entry_stat(files, i);
+        lsbin_record_t r;
+        r.size = files.bytes[i];
+        r.blocks = files.blocks[i];
+        r.ino = files.ino[i];
+        r.dev = files.dev[i];
+        r.nlink = files.nlink[i];
+        r.atime_ns = nanoseconds(files.atime[i]);
+        r.mtime_ns = nanoseconds(files.mtime[i]);
+        r.ctime_ns = nanoseconds(files.ctime[i]);
+        r.mode = files.mode[i];
+        r.uid = files.uid[i];
+        r.gid = files.gid[i];
+        r.name_len = files.name_len[i];
+        r.name_off = off;
+        off += files.name_len[i] + 1;
+        out.put(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+    for (std::size_t k = 0; k < files.size(); ++k) {
+        std::size_t i = files.order[k];
+        // names are NUL-terminated in the arena
+        out.put(files.name[i], files.name_len[i] + 1);
+    }
+    out.put(zeros, lsbin_pad(heap) - heap);
+}
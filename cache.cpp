@@ -0,0 +1,274 @@
+#include "ls.hpp"
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+// --cache: a directory's listing (names, d_type and whatever metadata the
+// run fetched) is saved to <cache dir>/<dev>-<ino>, and the next run that
+// lists the directory maps that file instead of calling getdents and
+// statx, as long as the directory's dev, ino, mtime and ctime are what
+// they were when it was saved. The file metadata served from a hit is only
+// as fresh as the directory: changing a file in place does not touch its
+// directory's mtime, which is what --refresh is for. Subdirectories are
+// the exception; they are cheap to stat again and change all the time.
+
+static const char cache_magic[8] = {'L', 'S', 'C', 'A', 'C', 'H', 'E', '\0'};
+static const unsigned int cache_version = 2;
+
+struct cache_header_t {
+    char magic[8];
+    unsigned int version;
+    unsigned int mask;      // STATX_* the saved metadata was fetched with
+    unsigned int filter;    // cache_filter() of the run that saved it
+    unsigned int count;
+    unsigned long long dev, ino;
+    long long mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+    unsigned long long names_size;
+};
+
+struct cache_entry_t {
+    unsigned long long size, blocks, ino, dev, nlink;
+    long long mtime_sec, mtime_nsec, atime_sec, atime_nsec, ctime_sec, ctime_nsec;
+    unsigned int mode, uid, gid;
+    unsigned int name_off, name_len;
+    unsigned char d_type, has_stat;
+};
+
+static bool enabled = false, refresh = false;
+static std::string cache_dir;
+static unsigned int run_mask = 0;
+static std::atomic<unsigned long> hits(0), misses(0), stores(0);
+
+static bool make_dirs(const std::string& path)
+{
+    for (std::size_t i = 1; i <= path.size(); ++i) {
+        if (i < path.size() && path[i] != '/')
+            continue;
+        if (mkdir(path.substr(0, i).c_str(), 0700) == -1 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+// dir is --cache=DIR, or NULL for $XDG_CACHE_HOME/ls or ~/.cache/ls. A
+// cache directory that cannot be created quietly turns the cache off.
+void cache_init(const ls_attr_t& attr, const char* dir)
+{
+    if (!attr.cache)
+        return;
+    if (dir) {
+        cache_dir = dir;
+    } else if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        cache_dir = std::string(xdg) + "/ls";
+    } else if (const char* home = std::getenv("HOME")) {
+        cache_dir = std::string(home) + "/.cache/ls";
+    } else {
+        return;
+    }
+    enabled = make_dirs(cache_dir);
+    refresh = attr.cache_refresh;
+    run_mask = meta_mask_for(attr);
+}
+
+// what decided which entries made it into a saved listing; a listing
+// saved under a different filter is a miss. -B is among the patterns.
+static unsigned int cache_filter(const ls_attr_t& attr)
+{
+    return attr.all | filter_fingerprint() << 1;
+}
+
+static std::string cache_path(const struct stat& dir)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "/%llx-%llx", static_cast<unsigned long long>(dir.st_dev),
+                  static_cast<unsigned long long>(dir.st_ino));
+    return cache_dir + name;
+}
+
+static bool same_dir(const cache_header_t& h, const struct stat& dir)
+{
+    return h.dev == dir.st_dev && h.ino == dir.st_ino &&
+           h.mtime_sec == dir.st_mtim.tv_sec && h.mtime_nsec == dir.st_mtim.tv_nsec &&
+           h.ctime_sec == dir.st_ctim.tv_sec && h.ctime_nsec == dir.st_ctim.tv_nsec;
+}
+
+// Fills the (empty) table from the saved listing of the directory open as
+// dirfd. The saved metadata is only used if it was fetched with at least
+// the fields this run needs; otherwise the names alone are served and the
+// listing is saved again once the run has stat'ed them.
+bool cache_load(int dirfd, entry_table_t& table, const ls_attr_t& attr, cache_slot_t& slot)
+{
+    if (enabled)
+        stats_count(STATS_FSTAT);
+    slot.active = enabled && fstat(dirfd, &slot.dir) == 0;
+    slot.hit = false;
+    slot.stats = 0;
+    if (!slot.active)
+        return false;
+    if (refresh) {
+        misses.fetch_add(1);
+        return false;
+    }
+
+    int fd = open(cache_path(slot.dir).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < static_cast<off_t>(sizeof(cache_header_t))) {
+        if (fd != -1)
+            close(fd);
+        misses.fetch_add(1);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        misses.fetch_add(1);
+        return false;
+    }
+
+    // the file may be corrupt, or written by someone else sharing the cache
+    // directory: every size is checked against the file before it is used,
+    // in a way that cannot wrap
+    const char* base = static_cast<const char*>(map);
+    const cache_header_t* h = reinterpret_cast<const cache_header_t*>(base);
+    unsigned long long body = st.st_size - sizeof(*h);
+    bool valid = std::memcmp(h->magic, cache_magic, sizeof(cache_magic)) == 0 &&
+                 h->version == cache_version && h->filter == cache_filter(attr) && same_dir(*h, slot.dir) &&
+                 h->names_size <= body && h->count <= (body - h->names_size) / sizeof(cache_entry_t) &&
+                 body == h->count * sizeof(cache_entry_t) + h->names_size;
+    const cache_entry_t* e = reinterpret_cast<const cache_entry_t*>(base + sizeof(*h));
+    const char* names = valid ? reinterpret_cast<const char*>(e + h->count) : NULL;
+    if (valid) {
+        bool stats = (h->mask & run_mask) == run_mask;
+        for (unsigned int k = 0; k < h->count; ++k) {
+            unsigned long long off = e[k].name_off, len = e[k].name_len;
+            if (off > h->names_size || len > h->names_size - off) {
+                valid = false;
+                table.clear();
+                break;
+            }
+            std::size_t i = table.add(names + e[k].name_off, e[k].name_len, e[k].d_type);
+            if (!stats || !e[k].has_stat)
+                continue;
+            // counted as served even when dropped below, so dropping them
+            // does not make cache_store() save the listing again
+            ++slot.stats;
+            // a subdirectory's mtime moves with its contents, not with
+            // this directory's; those are always stat'ed afresh
+            if (!S_ISDIR(e[k].mode)) {
+                struct stat s;
+                s.st_mode = e[k].mode;
+                s.st_nlink = e[k].nlink;
+                s.st_uid = e[k].uid;
+                s.st_gid = e[k].gid;
+                s.st_size = e[k].size;
+                s.st_blocks = e[k].blocks;
+                s.st_mtim.tv_sec = e[k].mtime_sec;
+                s.st_mtim.tv_nsec = e[k].mtime_nsec;
+                s.st_atim.tv_sec = e[k].atime_sec;
+                s.st_atim.tv_nsec = e[k].atime_nsec;
+                s.st_ctim.tv_sec = e[k].ctime_sec;
+                s.st_ctim.tv_nsec = e[k].ctime_nsec;
+                s.st_ino = e[k].ino;
+                s.st_dev = e[k].dev;
+                table.set_stat(i, s);
+            }
+        }
+    }
+    munmap(map, st.st_size);
+
+    if (!valid) {
+        misses.fetch_add(1);
+        return false;
+    }
+    hits.fetch_add(1);
+    slot.hit = true;
+    return true;
+}
+
+// Saves the table after a miss, or after a hit the run had to stat more
+// entries for. Written to a temporary file and renamed into place, so
+// concurrent runs never map half a listing.
+void cache_store(const entry_table_t& table, const ls_attr_t& attr, const cache_slot_t& slot)
+{
+    // a listing the predicates cut down is not the directory's
+    if (!slot.active || predicates_active(attr))
+        return;
+    std::size_t stats = 0;
+    for (std::size_t i = 0; i < table.size(); ++i)
+        stats += table.has_stat[i];
+    if (slot.hit && stats <= slot.stats)
+        return;
+    // a directory changed within the last second may change again without
+    // its mtime moving on filesystems with coarse timestamps
+    if (slot.dir.st_mtime >= std::time(NULL) - 1)
+        return;
+
+    cache_header_t h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, cache_magic, sizeof(cache_magic));
+    h.version = cache_version;
+    h.mask = run_mask;
+    h.filter = cache_filter(attr);
+    h.count = table.size();
+    h.dev = slot.dir.st_dev;
+    h.ino = slot.dir.st_ino;
+    h.mtime_sec = slot.dir.st_mtim.tv_sec;
+    h.mtime_nsec = slot.dir.st_mtim.tv_nsec;
+    h.ctime_sec = slot.dir.st_ctim.tv_sec;
+    h.ctime_nsec = slot.dir.st_ctim.tv_nsec;
+
+    std::vector<cache_entry_t> entries(table.size());
+    std::string names;
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        cache_entry_t& e = entries[i];
+        std::memset(&e, 0, sizeof(e));
+        e.name_off = names.size();
+        e.name_len = table.name_len[i];
+        e.d_type = table.d_type[i];
+        e.has_stat = table.has_stat[i];
+        names.append(table.name[i], table.name_len[i]);
+        if (e.has_stat) {
+            e.mode = table.mode[i];
+            e.nlink = table.nlink[i];
+            e.uid = table.uid[i];
+            e.gid = table.gid[i];
+            e.size = table.bytes[i];
+            e.blocks = table.blocks[i];
+            e.mtime_sec = table.mtime[i].tv_sec;
+            e.mtime_nsec = table.mtime[i].tv_nsec;
+            e.atime_sec = table.atime[i].tv_sec;
+            e.atime_nsec = table.atime[i].tv_nsec;
+            e.ctime_sec = table.ctime[i].tv_sec;
+            e.ctime_nsec = table.ctime[i].tv_nsec;
+            e.ino = table.ino[i];
+            e.dev = table.dev[i];
+        }
+    }
+    h.names_size = names.size();
+
+    std::string path = cache_path(slot.dir);
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(syscall(SYS_gettid));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+    struct iovec iov[3] = {
+        {&h, sizeof(h)},
+        {entries.data(), entries.size() * sizeof(cache_entry_t)},
+        {const_cast<char*>(names.data()), names.size()}
+    };
+    ssize_t want = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    bool ok = writev(fd, iov, 3) == want;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+        unlink(tmp.c_str());
+        return;
+    }
+    stores.fetch_add(1);
+}
+
+void cache_counters(unsigned long& hit, unsigned long& miss, unsigned long& stored)
+{
+    hit = hits.load();
+    miss = misses.load();
+    stored = stores.load();
+}
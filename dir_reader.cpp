@@ -0,0 +1,38 @@
+#include "ls.hpp"
+
+dir_reader_t::dir_reader_t(std::size_t buf_size)
+    : buf(buf_size), fd(-1), len(0), pos(0)
+{
+}
+
+void dir_reader_t::attach(int dirfd)
+{
+    fd = dirfd;
+    len = pos = 0;
+}
+
+bool dir_reader_t::next_batch()
+{
+    phase_timer_t timer(PHASE_READ);
+    stats_count(STATS_GETDENTS);
+    long n = syscall(SYS_getdents64, fd, &buf[0], buf.size());
+    if (n == -1) {
+        std::printf("dir_reader_t::next_batch\n");
+        std::perror("getdents64");
+        std::exit(1);
+    }
+    stats_count(STATS_DIRENT_BYTES, n);
+    len = n;
+    pos = 0;
+    return n > 0;
+}
+
+const struct dirent64* dir_reader_t::next()
+{
+    if (pos >= len)
+        return NULL;
+    const struct dirent64* d = reinterpret_cast<const struct dirent64*>(&buf[pos]);
+    pos += d->d_reclen;
+    stats_count(STATS_DIRENTS);
+    return d;
+}
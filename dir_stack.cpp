@@ -0,0 +1,131 @@
+#include "ls.hpp"
+
+dir_stack_t::dir_stack_t(int max_open_fds)
+    : max_open(max_open_fds), open_count(0)
+{
+}
+
+dir_stack_t::~dir_stack_t()
+{
+    while (!levels.empty())
+        pop();
+}
+
+// how many directory fds a walk may keep open: a quarter of RLIMIT_NOFILE,
+// within sane bounds
+int dir_stack_t::default_max_open()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY)
+        return 256;
+    return std::max<int>(8, std::min<rlim_t>(256, rl.rlim_cur / 4));
+}
+
+bool dir_stack_t::push(const std::string& name, const std::string& display)
+{
+    // only the walk's root may be reached through a symlink
+    int parent = AT_FDCWD, flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!levels.empty()) {
+        parent = top();
+        flags |= O_NOFOLLOW;
+    }
+    stats_count(STATS_OPEN_DIR);
+    int fd = openat(parent, name.c_str(), flags);
+    if (fd == -1)
+        return false;
+
+    level_t l;
+    l.name = name;
+    l.fd = fd;
+    l.dev = 0;
+    l.ino = 0;
+    l.path_len = path.size();
+    levels.push_back(l);
+    if (levels.size() == 1)
+        path = display;
+    else
+        path += "/" + name;
+
+    if (++open_count > max_open)
+        evict();
+    return true;
+}
+
+void dir_stack_t::pop()
+{
+    level_t& l = levels.back();
+    if (l.fd != -1) {
+        close(l.fd);
+        --open_count;
+    }
+    path.resize(l.path_len);
+    levels.pop_back();
+}
+
+int dir_stack_t::top()
+{
+    std::size_t i = levels.size() - 1;
+    if (levels[i].fd == -1)
+        reopen(i);
+    return levels[i].fd;
+}
+
+// close the shallowest open level; remember its identity so reopen() can
+// tell whether ".." still leads back to it
+void dir_stack_t::evict()
+{
+    for (std::size_t i = 0; i + 1 < levels.size(); ++i) {
+        if (levels[i].fd == -1)
+            continue;
+        struct stat st;
+        stats_count(STATS_FSTAT);
+        if (fstat(levels[i].fd, &st) == 0) {
+            levels[i].dev = st.st_dev;
+            levels[i].ino = st.st_ino;
+        }
+        close(levels[i].fd);
+        levels[i].fd = -1;
+        --open_count;
+        return;
+    }
+}
+
+// Coming back up past an evicted level. ".." of the child we just left is
+// the cheap way there; if the tree was moved under us (the dev/ino do not
+// match), walk down again by name from the nearest level still open.
+void dir_stack_t::reopen(std::size_t i)
+{
+    int fd = -1;
+    if (i + 1 < levels.size() && levels[i + 1].fd != -1) {
+        stats_count(STATS_OPEN_DIR);
+        stats_count(STATS_FSTAT);
+        fd = openat(levels[i + 1].fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct stat st;
+        if (fd != -1 && (fstat(fd, &st) == -1 || st.st_dev != levels[i].dev || st.st_ino != levels[i].ino)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd == -1) {
+        std::size_t j = i;
+        while (j > 0 && levels[j - 1].fd == -1)
+            --j;
+        int base = j == 0 ? AT_FDCWD : levels[j - 1].fd;
+        for (; j <= i; ++j) {
+            stats_count(STATS_OPEN_DIR);
+            fd = openat(base, levels[j].name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (base != AT_FDCWD && (j == 0 || base != levels[j - 1].fd))
+                close(base);
+            if (fd == -1) {
+                std::printf("dir_stack_t::reopen\n");
+                std::printf("%s\n", path.c_str());
+                std::perror("openat");
+                std::exit(1);
+            }
+            base = fd;
+        }
+    }
+    levels[i].fd = fd;
+    if (++open_count > max_open)
+        evict();
+}
@@ -0,0 +1,193 @@
+#include "ls.hpp"
+
+// --du and --summarize: instead of listing, add up what every directory
+// holds. A directory's subtotal is its own inode, every non-directory
+// entry in it, and the subtotals of its subdirectories. Files with more
+// than one link are counted the first time any of their names is seen,
+// across the whole run and all walk threads. Hidden entries count even
+// without -a.
+
+// (dev, ino) of every multiply linked file seen so far: open addressing in
+// a handful of independently locked shards. ino 0 marks a free slot.
+struct inode_key_t {
+    dev_t dev;
+    ino_t ino;
+};
+
+struct inode_shard_t {
+    std::mutex lock;
+    std::vector<inode_key_t> slots;
+    std::size_t used;
+};
+
+static const int shard_bits = 4;
+static inode_shard_t shards[1 << shard_bits];
+
+// the directories reported so far, filled by the thread that walks (or
+// stitches) the tree
+struct du_record_t {
+    std::string path;
+    du_totals_t sum;
+};
+
+static std::vector<du_record_t> records;
+
+static unsigned long long inode_hash(dev_t dev, ino_t ino)
+{
+    unsigned long long h = (ino ^ static_cast<unsigned long long>(dev) << 32) * 0x9E3779B97F4A7C15ULL;
+    return h ^ h >> 29;
+}
+
+static void shard_insert(std::vector<inode_key_t>& slots, const inode_key_t& k, unsigned long long h)
+{
+    std::size_t mask = slots.size() - 1;
+    for (std::size_t i = h & mask; ; i = (i + 1) & mask) {
+        if (slots[i].ino == 0) {
+            slots[i] = k;
+            return;
+        }
+    }
+}
+
+// true the first time (dev, ino) is seen
+static bool first_sighting(dev_t dev, ino_t ino)
+{
+    unsigned long long h = inode_hash(dev, ino);
+    inode_shard_t& s = shards[h >> (64 - shard_bits)];
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    if (s.slots.empty()) {
+        s.slots.resize(64);
+        s.used = 0;
+    }
+    std::size_t mask = s.slots.size() - 1;
+    for (std::size_t i = h & mask; s.slots[i].ino != 0; i = (i + 1) & mask) {
+        if (s.slots[i].ino == ino && s.slots[i].dev == dev)
+            return false;
+    }
+
+    // keep the load under a half so probes stay short
+    if (2 * (s.used + 1) > s.slots.size()) {
+        std::vector<inode_key_t> bigger(2 * s.slots.size());
+        for (std::size_t i = 0; i < s.slots.size(); ++i) {
+            if (s.slots[i].ino != 0)
+                shard_insert(bigger, s.slots[i], inode_hash(s.slots[i].dev, s.slots[i].ino));
+        }
+        s.slots.swap(bigger);
+    }
+    inode_key_t k = {dev, ino};
+    shard_insert(s.slots, k, h);
+    ++s.used;
+    return true;
+}
+
+void du_add(du_totals_t& sum, const du_totals_t& part)
+{
+    sum.blocks += part.blocks;
+    sum.bytes += part.bytes;
+    sum.files += part.files;
+    sum.dirs += part.dirs;
+}
+
+// reads the directory open as dirfd and adds it (but not its
+// subdirectories) to sum; the subdirectories go to subdirs
+void du_dir(int dirfd, dir_reader_t& reader, entry_table_t& table, std::vector<std::string>& subdirs,
+            du_totals_t& sum)
+{
+    const struct dirent64* entry;
+    table.clear();
+    table.dirfd = dirfd;
+    reader.attach(dirfd);
+    {
+        phase_timer_t timer(PHASE_READ);
+        while (reader.next_batch()) {
+            while ((entry = reader.next()) != NULL) {
+                const char* name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                    continue;
+                table.add(name, std::strlen(name), entry->d_type);
+            }
+        }
+    }
+    fill_stats(table);
+
+    stats_count(STATS_ENTRIES, table.size());
+    stats_count(STATS_FSTAT);
+    struct stat st;
+    if (fstat(dirfd, &st) == 0) {
+        sum.blocks += st.st_blocks;
+        sum.bytes += st.st_size;
+    }
+    ++sum.dirs;
+
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        if (descend_into(table, i)) {
+            subdirs.push_back(std::string(table.name[i], table.name_len[i]));
+            continue;
+        }
+        if (table.nlink[i] > 1 && !first_sighting(table.dev[i], table.ino[i]))
+            continue;
+        sum.blocks += table.blocks[i];
+        sum.bytes += table.bytes[i];
+        ++sum.files;
+    }
+}
+
+void du_record(const std::string& path, const du_totals_t& sum)
+{
+    du_record_t r = {path, sum};
+    records.push_back(r);
+}
+
+static bool larger_first(const du_record_t& a, const du_record_t& b)
+{
+    if (a.sum.blocks != b.sum.blocks)
+        return a.sum.blocks > b.sum.blocks;
+    return a.path < b.path;
+}
+
+static int digits(unsigned long long n)
+{
+    int d = 1;
+    while (n >= 10) {
+        n /= 10;
+        ++d;
+    }
+    return d;
+}
+
+// one line per recorded directory, largest first: 1K blocks in use,
+// apparent size in bytes, files, directories, path. --format=json gets
+// one object per directory with the raw 512-byte block count instead.
+void du_report(writer_t& out, const ls_attr_t& attr)
+{
+    std::sort(records.begin(), records.end(), larger_first);
+    if (attr.format == FORMAT_JSON) {
+        for (std::size_t i = 0; i < records.size(); ++i)
+            json_du(out, records[i].path, records[i].sum);
+        records.clear();
+        return;
+    }
+    int width[4] = {0, 0, 0, 0};
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const du_totals_t& s = records[i].sum;
+        width[0] = std::max(width[0], digits(s.blocks / 2));
+        width[1] = std::max(width[1], digits(s.bytes));
+        width[2] = std::max(width[2], digits(s.files));
+        width[3] = std::max(width[3], digits(s.dirs));
+    }
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const du_totals_t& s = records[i].sum;
+        out.num(s.blocks / 2, width[0]);
+        out.put(' ');
+        out.num(s.bytes, width[1]);
+        out.put(' ');
+        out.num(s.files, width[2]);
+        out.put(' ');
+        out.num(s.dirs, width[3]);
+        out.put(' ');
+        out.put(records[i].path);
+        out.put('\n');
+    }
+    records.clear();
+}
@@ -0,0 +1,279 @@
+#include "ls.hpp"
+
+#include <fnmatch.h>
+
+// --ignore (-I), --hide and -B: shell patterns matched against the raw
+// getdents names, before anything is stat'ed or copied. Each pattern is
+// classified once at startup; the common shapes are matched with a
+// memcmp and only the rest go through fnmatch(3). Matching follows
+// fnmatch with FNM_PERIOD, like GNU ls: a leading '.' is only matched by
+// a literal '.', so "*~" leaves ".profile~" alone.
+
+enum {
+    PATTERN_LITERAL,    // no wildcards
+    PATTERN_PREFIX,     // "abc*"
+    PATTERN_SUFFIX,     // "*abc"
+    PATTERN_GLOB        // anything else
+};
+
+struct pattern_t {
+    int kind;
+    std::string text;       // the literal part, or the whole glob
+};
+
+static std::vector<pattern_t> patterns;
+// "*.ext" patterns, kept apart so a name's extension is found only once
+static std::vector<std::string> extensions;
+static std::vector<std::string> globs;      // the patterns as given
+static unsigned int fingerprint = 0;
+
+static bool has_wildcard(const std::string& s)
+{
+    return s.find_first_of("*?[\\") != std::string::npos;
+}
+
+static void compile(const std::string& p)
+{
+    globs.push_back(p);
+    pattern_t c;
+    if (!has_wildcard(p)) {
+        c.kind = PATTERN_LITERAL;
+        c.text = p;
+    } else if (p.size() > 1 && p[p.size() - 1] == '*' && !has_wildcard(p.substr(0, p.size() - 1))) {
+        c.kind = PATTERN_PREFIX;
+        c.text = p.substr(0, p.size() - 1);
+    } else if (p[0] == '*' && !has_wildcard(p.substr(1))) {
+        std::string tail = p.substr(1);
+        if (tail.size() > 1 && tail[0] == '.' && tail.find('.', 1) == std::string::npos) {
+            extensions.push_back(tail);
+            return;
+        }
+        c.kind = PATTERN_SUFFIX;
+        c.text = tail;
+    } else {
+        c.kind = PATTERN_GLOB;
+        c.text = p;
+    }
+    patterns.push_back(c);
+}
+
+// ignore patterns always apply, hide patterns only without -a; -B is
+// shorthand for --ignore='*~' --ignore='.*~'
+void filter_init(const ls_attr_t& attr, const std::vector<std::string>& ignore,
+                 const std::vector<std::string>& hide)
+{
+    for (std::size_t i = 0; i < ignore.size(); ++i)
+        compile(ignore[i]);
+    if (!attr.all) {
+        for (std::size_t i = 0; i < hide.size(); ++i)
+            compile(hide[i]);
+    }
+    if (attr.ignore_backups) {
+        compile("*~");
+        compile(".*~");
+    }
+
+    // FNV-1a over the patterns in effect, for the listing cache
+    unsigned int h = 2166136261u;
+    for (std::size_t i = 0; i < globs.size(); ++i) {
+        for (std::size_t k = 0; k <= globs[i].size(); ++k) {
+            h ^= static_cast<unsigned char>(globs[i].c_str()[k]);
+            h *= 16777619u;
+        }
+    }
+    fingerprint = globs.empty() ? 0 : h;
+}
+
+static bool ends_with(const char* name, std::size_t len, const std::string& s)
+{
+    return len >= s.size() && std::memcmp(name + len - s.size(), s.data(), s.size()) == 0;
+}
+
+// true if name (len bytes, NUL-terminated) matches any pattern in effect
+bool filter_match(const char* name, std::size_t len)
+{
+    if (globs.empty())
+        return false;
+    // a leading '*' cannot match a leading '.', nor can it match nothing
+    // and leave the '.' to the literal after it
+    bool dot = name[0] == '.';
+
+    if (!extensions.empty() && !dot) {
+        const char* ext = static_cast<const char*>(memrchr(name, '.', len));
+        if (ext) {
+            std::size_t n = name + len - ext;
+            for (std::size_t i = 0; i < extensions.size(); ++i) {
+                const std::string& e = extensions[i];
+                if (e.size() == n && std::memcmp(ext, e.data(), n) == 0)
+                    return true;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < patterns.size(); ++i) {
+        const pattern_t& p = patterns[i];
+        switch (p.kind) {
+        case PATTERN_LITERAL:
+            if (len == p.text.size() && std::memcmp(name, p.text.data(), len) == 0)
+                return true;
+            break;
+        case PATTERN_PREFIX:
+            // the prefix is literal, so it matches a leading '.' itself
+            if (len >= p.text.size() && std::memcmp(name, p.text.data(), p.text.size()) == 0)
+                return true;
+            break;
+        case PATTERN_SUFFIX:
+            if (!dot && ends_with(name, len, p.text))
+                return true;
+            break;
+        default:
+            if (fnmatch(p.text.c_str(), name, FNM_PERIOD) == 0)
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
+unsigned int filter_fingerprint()
+{
+    return fingerprint;
+}
+
+// --type letters, as find(1) spells them
+bool parse_types(const char* s, unsigned int& types)
+{
+    types = 0;
+    for (; *s; ++s) {
+        mode_t t;
+        switch (*s) {
+        case 'f': t = S_IFREG; break;
+        case 'd': t = S_IFDIR; break;
+        case 'l': t = S_IFLNK; break;
+        case 'b': t = S_IFBLK; break;
+        case 'c': t = S_IFCHR; break;
+        case 'p': t = S_IFIFO; break;
+        case 's': t = S_IFSOCK; break;
+        case ',': continue;
+        default: return false;
+        }
+        types |= 1u << (t >> 12);
+    }
+    return types != 0;
+}
+
+// --newer-than and --older-than: an age such as 30m, 12h, 7d or 2w
+// (days without a unit), @SECONDS since the epoch, or a local date
+// YYYY-MM-DD with an optional HH:MM[:SS]
+bool parse_when(const char* s, time_t& when)
+{
+    if (s[0] == '@') {
+        char* end;
+        long long t = std::strtoll(s + 1, &end, 10);
+        when = t;
+        return end != s + 1 && *end == '\0';
+    }
+
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(s, "%Y-%m-%d", &tm);
+    if (end && (*end == '\0' || ((end = strptime(end, " %H:%M", &tm)) && (*end == '\0' ||
+                                 ((end = strptime(end, ":%S", &tm)) && *end == '\0'))))) {
+        tm.tm_isdst = -1;
+        when = std::mktime(&tm);
+        return true;
+    }
+
+    char* unit;
+    unsigned long long n = std::strtoull(s, &unit, 10);
+    if (unit == s)
+        return false;
+    long long scale;
+    switch (*unit) {
+    case 's': scale = 1; break;
+    case 'm': scale = 60; break;
+    case 'h': scale = 3600; break;
+    case 'd': case '\0': scale = 86400; break;
+    case 'w': scale = 7 * 86400; break;
+    default: return false;
+    }
+    if (*unit != '\0' && unit[1] != '\0')
+        return false;
+    when = std::time(NULL) - static_cast<time_t>(n * scale);
+    return true;
+}
+
+// --uid: a number, or a user name looked up once here
+bool parse_owner(const char* s, uid_t& uid)
+{
+    char* end;
+    unsigned long n = std::strtoul(s, &end, 10);
+    if (end != s && *end == '\0') {
+        uid = n;
+        return true;
+    }
+    struct passwd pw, *res = NULL;
+    char buf[4096];
+    if (getpwnam_r(s, &pw, buf, sizeof(buf), &res) != 0 || res == NULL)
+        return false;
+    uid = pw.pw_uid;
+    return true;
+}
+
+bool predicates_active(const ls_attr_t& attr)
+{
+    const predicates_t& p = attr.pred;
+    return p.types || p.min_size || p.max_size || p.newer || p.older || p.owner;
+}
+
+static bool wants_stat(const predicates_t& p)
+{
+    return p.min_size || p.max_size || p.newer || p.older || p.owner;
+}
+
+static bool passes_stat(const entry_table_t& t, std::size_t i, const predicates_t& p)
+{
+    unsigned long long size = t.bytes[i];
+    const struct timespec& m = t.mtime[i];
+    if ((p.min_size && size < p.min_bytes) || (p.max_size && size > p.max_bytes))
+        return false;
+    if (p.newer && !(m.tv_sec > p.newer_than || (m.tv_sec == p.newer_than && m.tv_nsec > 0)))
+        return false;
+    if (p.older && !(m.tv_sec < p.older_than))
+        return false;
+    return !p.owner || t.uid[i] == p.uid;
+}
+
+// Drops the entries of the (unsorted) table that fail a predicate, in two
+// rounds so nothing is stat'ed that --type already ruled out: --type is
+// answered from d_type where getdents gave one, then whatever survives is
+// stat'ed in one batch for the other predicates. True if any entry was
+// dropped.
+bool apply_predicates(entry_table_t& t, const ls_attr_t& attr)
+{
+    const predicates_t& p = attr.pred;
+    if (!predicates_active(attr) || t.size() == 0)
+        return false;
+    std::size_t before = t.size();
+    std::vector<unsigned char> keep(t.size(), 1);
+
+    if (p.types) {
+        for (std::size_t i = 0; i < t.size(); ++i) {
+            mode_t type = entry_type(t, i);
+            if (!(p.types & 1u << (type >> 12)))
+                keep[i] = 0;
+        }
+        t.keep(keep);
+    }
+
+    if (wants_stat(p) && t.size() > 0) {
+        fill_stats(t);
+        keep.assign(t.size(), 1);
+        for (std::size_t i = 0; i < t.size(); ++i) {
+            if (!passes_stat(t, i, p))
+                keep[i] = 0;
+        }
+        t.keep(keep);
+    }
+    return t.size() != before;
+}
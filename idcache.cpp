@@ -0,0 +1,101 @@
+#include "ls.hpp"
+
+// uid/gid -> name for the whole run. Every id goes to NSS (or the files
+// loaded by --load-ids) at most once; after that a lookup is a hash probe
+// in the calling thread's own map, falling back to the shared one under a
+// lock only the first time a thread sees an id.
+
+typedef std::unordered_map<unsigned int, std::string> id_map_t;
+typedef std::unordered_map<unsigned int, const std::string*> id_view_t;
+
+static bool numeric_ids = false;
+
+static std::mutex users_lock, groups_lock;
+static id_map_t users, groups;
+
+static thread_local id_view_t local_users, local_groups;
+
+static void load_users()
+{
+    stats_count(STATS_NSS);
+    FILE* fp = std::fopen("/etc/passwd", "r");
+    if (fp == NULL)
+        return;
+    struct passwd* pw;
+    while ((pw = fgetpwent(fp)) != NULL)
+        users.insert(id_map_t::value_type(pw->pw_uid, pw->pw_name));
+    std::fclose(fp);
+}
+
+static void load_groups()
+{
+    stats_count(STATS_NSS);
+    FILE* fp = std::fopen("/etc/group", "r");
+    if (fp == NULL)
+        return;
+    struct group* gr;
+    while ((gr = fgetgrent(fp)) != NULL)
+        groups.insert(id_map_t::value_type(gr->gr_gid, gr->gr_name));
+    std::fclose(fp);
+}
+
+void id_cache_init(const ls_attr_t& attr)
+{
+    numeric_ids = attr.numeric_ids;
+    if (attr.load_ids && !numeric_ids) {
+        load_users();
+        load_groups();
+    }
+}
+
+static std::string lookup_user(uid_t uid)
+{
+    struct passwd pw, *res = NULL;
+    char buf[4096];
+    if (!numeric_ids)
+        stats_count(STATS_NSS);
+    if (numeric_ids || getpwuid_r(uid, &pw, buf, sizeof(buf), &res) != 0 || res == NULL)
+        return std::to_string(uid);
+    return pw.pw_name;
+}
+
+static std::string lookup_group(gid_t gid)
+{
+    struct group gr, *res = NULL;
+    char buf[4096];
+    if (!numeric_ids)
+        stats_count(STATS_NSS);
+    if (numeric_ids || getgrgid_r(gid, &gr, buf, sizeof(buf), &res) != 0 || res == NULL)
+        return std::to_string(gid);
+    return gr.gr_name;
+}
+
+// names live in the shared map, whose nodes never move, so the per-thread
+// maps can point straight at them
+const std::string& user_name(uid_t uid)
+{
+    id_view_t::iterator it = local_users.find(uid);
+    if (it != local_users.end())
+        return *it->second;
+
+    std::lock_guard<std::mutex> guard(users_lock);
+    id_map_t::iterator s = users.find(uid);
+    if (s == users.end())
+        s = users.insert(id_map_t::value_type(uid, lookup_user(uid))).first;
+    local_users[uid] = &s->second;
+    return s->second;
+}
+
+const std::string& group_name(gid_t gid)
+{
+    id_view_t::iterator it = local_groups.find(gid);
+    if (it != local_groups.end())
+        return *it->second;
+
+    std::lock_guard<std::mutex> guard(groups_lock);
+    id_map_t::iterator s = groups.find(gid);
+    if (s == groups.end())
+        s = groups.insert(id_map_t::value_type(gid, lookup_group(gid))).first;
+    local_groups[gid] = &s->second;
+    return s->second;
+}
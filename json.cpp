@@ -0,0 +1,188 @@
+#include "ls.hpp"
+
+// --format=json: one JSON object per line (NDJSON). Every listed entry is
+// an object with its raw metadata: name, type, permission bits, sizes,
+// link count, ids and nanosecond timestamps. Under -R (and with several
+// operands) each directory's entries follow a {"dir": path} line, in the
+// same order the text listing would print them; file operands come first,
+// before any {"dir"} line. Everything is formatted straight into the
+// writer's buffer.
+
+// length of the well-formed UTF-8 sequence at s, or 0 if there is none
+static std::size_t utf8_length(const unsigned char* s, std::size_t n)
+{
+    unsigned char c = s[0];
+    unsigned char lo = 0x80, hi = 0xbf;
+    std::size_t len;
+    if (c >= 0xc2 && c <= 0xdf) {
+        len = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        if (c == 0xe0)
+            lo = 0xa0;      // overlong
+        else if (c == 0xed)
+            hi = 0x9f;      // surrogates
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4;
+        if (c == 0xf0)
+            lo = 0x90;      // overlong
+        else if (c == 0xf4)
+            hi = 0x8f;      // past U+10FFFF
+    } else {
+        return 0;
+    }
+    if (n < len || s[1] < lo || s[1] > hi)
+        return 0;
+    for (std::size_t i = 2; i < len; ++i) {
+        if (s[i] < 0x80 || s[i] > 0xbf)
+            return 0;
+    }
+    return len;
+}
+
+// A file name as a JSON string. Runs that need no escaping are copied in
+// one piece. Names are bytes, not text: a byte that is not part of valid
+// UTF-8 comes out as the lone surrogate \udcXX (what Python calls
+// surrogateescape), so such names still survive the round trip.
+void json_string(writer_t& out, const char* s, std::size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+    std::size_t run = 0, i = 0;
+
+    out.put('"');
+    while (i < n) {
+        unsigned char c = u[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+        std::size_t k = c >= 0x80 ? utf8_length(u + i, n - i) : 0;
+        if (k > 0) {
+            i += k;
+            continue;
+        }
+
+        out.put(s + run, i - run);
+        switch (c) {
+        case '"':
+            out.put("\\\"", 2);
+            break;
+        case '\\':
+            out.put("\\\\", 2);
+            break;
+        case '\n':
+            out.put("\\n", 2);
+            break;
+        case '\t':
+            out.put("\\t", 2);
+            break;
+        case '\r':
+            out.put("\\r", 2);
+            break;
+        default: {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            if (c >= 0x80) {
+                esc[2] = 'd';
+                esc[3] = 'c';
+            }
+            out.put(esc, sizeof(esc));
+            break;
+        }
+        }
+        run = ++i;
+    }
+    out.put(s + run, i - run);
+    out.put('"');
+}
+
+static void put_signed(writer_t& out, long long v)
+{
+    if (v < 0) {
+        out.put('-');
+        out.num(0ULL - static_cast<unsigned long long>(v));
+    } else {
+        out.num(v);
+    }
+}
+
+static void put_ns(writer_t& out, const struct timespec& ts)
+{
+    put_signed(out, static_cast<long long>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+}
+
+static const char* type_name(mode_t mode)
+{
+    if (S_ISREG(mode))
+        return "file";
+    if (S_ISDIR(mode))
+        return "dir";
+    if (S_ISLNK(mode))
+        return "symlink";
+    if (S_ISCHR(mode))
+        return "char";
+    if (S_ISBLK(mode))
+        return "block";
+    if (S_ISFIFO(mode))
+        return "fifo";
+    if (S_ISSOCK(mode))
+        return "socket";
+    return "unknown";
+}
+
+void json_dir(writer_t& out, const std::string& path)
+{
+    out.put("{\"dir\":");
+    json_string(out, path.data(), path.size());
+    out.put("}\n");
+}
+
+void json_print(entry_table_t& files, writer_t& out)
+{
+    fill_stats(files);
+    phase_timer_t timer(PHASE_FORMAT);
+    for (std::size_t k = 0; k < files.size(); ++k) {
+        std::size_t i = files.order[k];
+        entry_stat(files, i);
+        out.put("{\"name\":");
+        json_string(out, files.name[i], files.name_len[i]);
+        out.put(",\"type\":\"");
+        out.put(type_name(files.mode[i]));
+        out.put("\",\"mode\":");
+        out.num(files.mode[i] & 07777);
+        out.put(",\"size\":");
+        put_signed(out, files.bytes[i]);
+        out.put(",\"blocks\":");
+        put_signed(out, files.blocks[i]);
+        out.put(",\"nlink\":");
+        out.num(files.nlink[i]);
+        out.put(",\"uid\":");
+        out.num(files.uid[i]);
+        out.put(",\"gid\":");
+        out.num(files.gid[i]);
+        out.put(",\"ino\":");
+        out.num(files.ino[i]);
+        out.put(",\"atime_ns\":");
+        put_ns(out, files.atime[i]);
+        out.put(",\"mtime_ns\":");
+        put_ns(out, files.mtime[i]);
+        out.put(",\"ctime_ns\":");
+        put_ns(out, files.ctime[i]);
+        out.put("}\n");
+    }
+}
+
+void json_du(writer_t& out, const std::string& path, const du_totals_t& sum)
+{
+    out.put("{\"dir\":");
+    json_string(out, path.data(), path.size());
+    out.put(",\"blocks\":");
+    out.num(sum.blocks);
+    out.put(",\"bytes\":");
+    out.num(sum.bytes);
+    out.put(",\"files\":");
+    out.num(sum.files);
+    out.put(",\"dirs\":");
+    out.num(sum.dirs);
+    out.put("}\n");
+}
@@ -0,0 +1,59 @@
+#include "ls.hpp"
+
+// terminal width, asked for once per run; 0 when stdin is not a terminal
+int screen_cols()
+{
+    static const int cols = query_screen_col();
+    return cols;
+}
+
+// widest entry in w[first, last)
+static int span_max(const std::vector<int>& w, std::size_t first, std::size_t last)
+{
+    int m = 0;
+    for (std::size_t i = first; i < last; ++i)
+        m = std::max(m, w[i]);
+    return m;
+}
+
+// Does a layout with this many rows fit in cols? Entries run down the
+// columns; every full column is padded by two, a trailing partial one by
+// one. One linear pass, stopping as soon as the line is too long.
+static bool fits(const std::vector<int>& w, std::size_t rows, int cols)
+{
+    long s = 0;
+    std::size_t i;
+    for (i = 0; i + rows - 1 < w.size(); i += rows) {
+        s += span_max(w, i, i + rows) + 2;
+        if (s > cols)
+            return false;
+    }
+    if (i < w.size())
+        s += span_max(w, i, w.size()) + 1;
+    return s <= cols;
+}
+
+// The same binary search over the row count the layout has always used
+// (so the chosen layout does not change), at O(n) per probe and O(1)
+// extra memory. When nothing fits, every entry gets its own row.
+std::size_t layout_rows(const std::vector<int>& w, int cols)
+{
+    std::size_t l = 1, r = w.size(), rows = w.size();
+    while (l <= r) {
+        std::size_t mid = l + (r - l) / 2;
+        if (fits(w, mid, cols)) {
+            r = mid - 1;
+            rows = mid;
+        } else {
+            l = mid + 1;
+        }
+    }
+    return rows;
+}
+
+void column_widths(const std::vector<int>& w, std::size_t rows, std::vector<int>& out)
+{
+    out.clear();
+    for (std::size_t i = 0; i < w.size(); i += rows)
+        out.push_back(span_max(w, i, std::min(i + rows, w.size())));
+}
@@ -1,14 +1,70 @@
 #include "ls.hpp"
 
-bool (*cmp)(const std::string&, const std::string&);
+enum {
+    OPT_DIR_BUFFER = 256,
+    OPT_CACHED_ATTRS,
+    OPT_STAT_ENGINE,
+    OPT_THREADS,
+    OPT_LOAD_IDS,
+    OPT_TIME_STYLE,
+    OPT_DU,
+    OPT_SUMMARIZE,
+    OPT_CACHE,
+    OPT_NO_CACHE,
+    OPT_REFRESH,
+    OPT_CACHE_STATS,
+    OPT_FORMAT,
+    OPT_STATS,
+    OPT_TRACE,
+    OPT_HIDE,
+    OPT_MIN_SIZE,
+    OPT_MAX_SIZE,
+    OPT_NEWER_THAN,
+    OPT_OLDER_THAN,
+    OPT_TYPE,
+    OPT_UID
+};
+
+static const struct option long_options[] = {
+    {"dir-buffer", required_argument, NULL, OPT_DIR_BUFFER},
+    {"cached-attrs", no_argument, NULL, OPT_CACHED_ATTRS},
+    {"stat-engine", required_argument, NULL, OPT_STAT_ENGINE},
+    {"threads", required_argument, NULL, OPT_THREADS},
+    {"load-ids", no_argument, NULL, OPT_LOAD_IDS},
+    {"time-style", required_argument, NULL, OPT_TIME_STYLE},
+    {"du", no_argument, NULL, OPT_DU},
+    {"summarize", no_argument, NULL, OPT_SUMMARIZE},
+    {"cache", optional_argument, NULL, OPT_CACHE},
+    {"no-cache", no_argument, NULL, OPT_NO_CACHE},
+    {"refresh", no_argument, NULL, OPT_REFRESH},
+    {"cache-stats", no_argument, NULL, OPT_CACHE_STATS},
+    {"format", required_argument, NULL, OPT_FORMAT},
+    {"stats", no_argument, NULL, OPT_STATS},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"ignore", required_argument, NULL, 'I'},
+    {"hide", required_argument, NULL, OPT_HIDE},
+    {"min-size", required_argument, NULL, OPT_MIN_SIZE},
+    {"max-size", required_argument, NULL, OPT_MAX_SIZE},
+    {"newer-than", required_argument, NULL, OPT_NEWER_THAN},
+    {"older-than", required_argument, NULL, OPT_OLDER_THAN},
+    {"type", required_argument, NULL, OPT_TYPE},
+    {"uid", required_argument, NULL, OPT_UID},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
 
 int main(int argc, char* argv[])
 {
     ls_attr_t attr = {0};
+    attr.dir_buffer = 1 << 20;
+    attr.threads = 1;
+    const char* cache_dir = NULL;
+    const char* trace_file = NULL;
+    std::vector<std::string> ignore, hide;
 
     // parse the parameters
     int ch;
-    while ((ch = getopt(argc, argv, "1aBdfgGhilrRS")) != -1) {
+    while ((ch = getopt_long(argc, argv, "1aBdfgGhiI:lnrRStUvX", long_options, NULL)) != -1) {
         switch (ch) {
         case 'a': // print all files
             attr.all = 1;
@@ -31,9 +87,16 @@ int main(int argc, char* argv[])
         case 'i': // print the inode number
             attr.inode = 1;
             break;
+        case 'I': // never list entries matching a pattern
+            ignore.push_back(optarg);
+            break;
         case 'l': // detail info
             attr.long_format = 1;
             break;
+        case 'n': // like -l, numeric uid and gid
+            attr.long_format = 1;
+            attr.numeric_ids = 1;
+            break;
         case 'r': // reverse output
             attr.reverse = 1;
             break;
@@ -41,7 +104,19 @@ int main(int argc, char* argv[])
             attr.recursive = 1;
             break;
         case 'S': // sort by size
-            attr.sort_by_size = 1;
+            attr.sort = SORT_SIZE;
+            break;
+        case 't': // sort by mtime
+            attr.sort = SORT_TIME;
+            break;
+        case 'U': // directory order
+            attr.no_sort = 1;
+            break;
+        case 'v': // sort by version
+            attr.sort = SORT_VERSION;
+            break;
+        case 'X': // sort by extension
+            attr.sort = SORT_EXTENSION;
             break;
         case '1': // one column
             attr.one_column = 1;
@@ -50,247 +125,591 @@ int main(int argc, char* argv[])
             display_usage();
             std::exit(0);
             break;
+        case OPT_DIR_BUFFER: // getdents64 buffer size
+            attr.dir_buffer = parse_size(optarg);
+            if (attr.dir_buffer < 4096) {
+                std::fprintf(stderr, "ls: --dir-buffer must be at least 4K\n");
+                std::exit(1);
+            }
+            break;
+        case OPT_CACHED_ATTRS: // AT_STATX_DONT_SYNC
+            attr.cached_attrs = 1;
+            break;
+        case OPT_STAT_ENGINE: // sync or uring
+            if (std::strcmp(optarg, "uring") == 0) {
+                attr.stat_uring = 1;
+            } else if (std::strcmp(optarg, "sync") == 0) {
+                attr.stat_uring = 0;
+            } else {
+                std::fprintf(stderr, "ls: invalid --stat-engine '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_LOAD_IDS: // names from /etc/passwd and /etc/group
+            attr.load_ids = 1;
+            break;
+        case OPT_TIME_STYLE: // how -l prints mtime
+            if (!parse_time_style(optarg, attr.time_style)) {
+                std::fprintf(stderr, "ls: invalid --time-style '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_DU: // per-directory disk usage
+            attr.du = 1;
+            attr.recursive = 1;
+            break;
+        case OPT_SUMMARIZE: // disk usage of the operands only
+            attr.du = 1;
+            attr.summarize = 1;
+            attr.recursive = 1;
+            break;
+        case OPT_CACHE: // listings saved across runs
+            attr.cache = 1;
+            cache_dir = optarg;
+            break;
+        case OPT_NO_CACHE:
+            attr.cache = 0;
+            break;
+        case OPT_REFRESH: // ignore saved listings, save fresh ones
+            attr.cache_refresh = 1;
+            break;
+        case OPT_CACHE_STATS:
+            attr.cache_stats = 1;
+            break;
+        case OPT_FORMAT: // text, json or binary
+            if (std::strcmp(optarg, "json") == 0) {
+                attr.format = FORMAT_JSON;
+            } else if (std::strcmp(optarg, "binary") == 0) {
+                attr.format = FORMAT_BINARY;
+            } else if (std::strcmp(optarg, "text") == 0) {
+                attr.format = FORMAT_TEXT;
+            } else {
+                std::fprintf(stderr, "ls: invalid --format '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_STATS: // syscall counts and phase times on stderr
+            attr.stats = 1;
+            break;
+        case OPT_HIDE: // like -I, unless -a
+            hide.push_back(optarg);
+            break;
+        case OPT_MIN_SIZE: // list only entries of at least SIZE bytes
+            attr.pred.min_size = true;
+            attr.pred.min_bytes = parse_size(optarg);
+            break;
+        case OPT_MAX_SIZE: // list only entries of at most SIZE bytes
+            attr.pred.max_size = true;
+            attr.pred.max_bytes = parse_size(optarg);
+            break;
+        case OPT_NEWER_THAN: // list only entries modified after WHEN
+            attr.pred.newer = true;
+            if (!parse_when(optarg, attr.pred.newer_than)) {
+                std::fprintf(stderr, "ls: invalid --newer-than '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_OLDER_THAN: // list only entries modified before WHEN
+            attr.pred.older = true;
+            if (!parse_when(optarg, attr.pred.older_than)) {
+                std::fprintf(stderr, "ls: invalid --older-than '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_TYPE: // list only entries of these types
+            if (!parse_types(optarg, attr.pred.types)) {
+                std::fprintf(stderr, "ls: invalid --type '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_UID: // list only entries owned by this user
+            attr.pred.owner = true;
+            if (!parse_owner(optarg, attr.pred.uid)) {
+                std::fprintf(stderr, "ls: invalid --uid '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
+        case OPT_TRACE: // Chrome trace of directories and phases
+            trace_file = optarg;
+            break;
+        case OPT_THREADS: // stat workers
+            attr.threads = std::atoi(optarg);
+            if (attr.threads < 1) {
+                std::fprintf(stderr, "ls: invalid --threads '%s'\n", optarg);
+                std::exit(1);
+            }
+            break;
         }
     }
-
-    // default: alpha order
-    cmp = attr.sort_by_size ? size_cmp : [](const std::string& a, const std::string& b) { return a < b; };
-
-    std::vector<std::string> files;
-    for (int i = 1; i < argc; ++i) {
-        if (argv[i][0] != '-')
-            files.push_back(argv[i]);
-    }
-    if (!attr.no_sort) {
-        std::sort(files.begin(), files.end());
-        std::stable_sort(files.begin(), files.end(), cmp);
+    stats_init(attr);
+    trace_init(trace_file);
+    if (attr.format == FORMAT_BINARY) {
+        if (attr.du) {
+            std::fprintf(stderr, "ls: --format=binary does not apply to --du\n");
+            std::exit(1);
+        }
+        if (isatty(STDOUT_FILENO)) {
+            std::fprintf(stderr, "ls: not writing --format=binary to a terminal\n");
+            std::exit(1);
+        }
+        binary_header(stdout_writer);
     }
-    if (attr.reverse)
-        std::reverse(files.begin(), files.end());
+    filter_init(attr, ignore, hide);
+    meta_init(attr);
+    id_cache_init(attr);
+    time_init(attr);
+    cache_init(attr, cache_dir);
+
+    entry_table_t files;
+    for (int i = optind; i < argc; ++i)
+        files.add(argv[i], std::strlen(argv[i]));
+    sort_entries(files, attr);
 
     list_all_files(files, attr);
+
+    if (attr.cache_stats) {
+        unsigned long hit, miss, stored;
+        cache_counters(hit, miss, stored);
+        stdout_writer.flush();
+        std::fprintf(stderr, "cache: %lu hits, %lu misses, %lu stored\n", hit, miss, stored);
+    }
+    stats_report();
+    trace_write();
     return 0;
 }
 
-void list_all_files(const std::vector<std::string>& files, const ls_attr_t& attr)
+// what a directory's listing starts with under -R or with several
+// operands
+static void put_header(const std::string& header, const ls_attr_t& attr, writer_t& out)
 {
-    struct stat buf;
-    std::vector<std::string> collector;
-    for (int i = 0; i < files.size(); ++i) {
-        if (fstatat(AT_FDCWD, files[i].c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-            std::printf("list_all_files\n");
-            std::perror("stat");
-            std::exit(1);
-        }
-        if (files.size() != 1 && is_dir_file(files[i]) && !attr.dir)
-            std::cout << files[i] << ":\n";
+    if (attr.format == FORMAT_JSON) {
+        json_dir(out, header);
+    } else if (attr.format == FORMAT_BINARY) {
+        binary_dir(out, header);
+    } else {
+        out.put(header);
+        out.put(":\n");
+    }
+}
 
-        if (S_ISDIR(buf.st_mode) && !attr.dir)
-            walk_dir(files[i], attr);
-        else if (is_dir_file(files[i]) || is_reg_file(files[i]))
-            collector.push_back(files[i]);
+static void put_operand_files(entry_table_t& collector, const ls_attr_t& attr)
+{
+    if (collector.size() > 0) {
+        pretty_print(collector, attr, stdout_writer);
+        stdout_writer.boundary();
     }
-    if (collector.size() > 0)
-        pretty_print(collector, attr);
+}
+
+void list_all_files(entry_table_t& files, const ls_attr_t& attr)
+{
+    entry_table_t collector;
+    for (std::size_t k = 0; k < files.size(); ++k) {
+        std::size_t i = files.order[k];
+        bool is_dir = is_dir_file(files, i);
+        if (!(is_dir && !attr.dir) && (is_dir || is_reg_file(files, i)))
+            collector.add_row(files, i);
+    }
+    // in the machine formats entries belong to the last directory record
+    // before them, so the file operands go out ahead of the first one
+    if (attr.format != FORMAT_TEXT)
+        put_operand_files(collector, attr);
+
+    for (std::size_t k = 0; k < files.size(); ++k) {
+        std::size_t i = files.order[k];
+        if (!is_dir_file(files, i) || attr.dir)
+            continue;
+        // under -R the walk's own header says the same, which is all the
+        // machine formats need; --du lines carry their own paths
+        if (files.size() != 1 && !attr.du && (attr.format == FORMAT_TEXT || !attr.recursive))
+            put_header(std::string(files.name[i], files.name_len[i]), attr, stdout_writer);
+        walk_dir(files.name[i], attr);
+    }
+    if (attr.format == FORMAT_TEXT)
+        put_operand_files(collector, attr);
 
     // default (./)
-    if (files.size() == 0 && !attr.dir)
+    if (files.size() == 0 && !attr.dir) {
         walk_dir(".", attr);
-    else if (files.size() == 0)
-        pretty_print(std::vector<std::string>(1, "."), attr);
+    } else if (files.size() == 0) {
+        entry_table_t cur;
+        cur.add(".", 1);
+        pretty_print(cur, attr, stdout_writer);
+    }
 }
 
-void walk_dir(const std::string& path_name, const ls_attr_t& attr)
+// -a, -B, --ignore and --hide filtering, done on the raw dirent name.
+// Under -R a skipped directory is never descended into.
+bool skip_entry(const char* name, std::size_t len, const ls_attr_t& attr)
 {
-    DIR* dir;
-    struct dirent* entry;
-    char old_entry[BUFSIZ];
+    if (!attr.all && name[0] == '.')
+        return true;
+    return filter_match(name, len);
+}
 
-    getcwd(old_entry, BUFSIZ);
+// entries per window of a streamed listing
+static const std::size_t stream_window = 4096;
 
-    if ((dir = opendir(path_name.c_str())) == NULL) {
-        std::printf("walk_dir\n");
-        std::perror("opendir");
-        std::exit(1);
+// -f without -r: nothing needs the whole directory at once
+bool streaming(const ls_attr_t& attr)
+{
+    return attr.no_sort && !attr.reverse;
+}
+
+// Prints entries as they are read, holding at most one window of them.
+// Padding, the column layout and the -l widths are worked out a window at
+// a time (so -1 pads to the widest name of its window), and the -l total
+// is only printed when the whole directory fit in one window. The table
+// holds the current window.
+static void flush_window(entry_table_t& window, const ls_attr_t& attr, writer_t& out)
+{
+    apply_predicates(window, attr);
+    pretty_print(window, attr, out, NULL, false);
+    out.boundary();
+    window.clear();
+}
+
+static void stream_dir(dir_reader_t& reader, entry_table_t& window, std::vector<std::string>& subdirs,
+                       const ls_attr_t& attr, writer_t& out)
+{
+    const struct dirent64* entry;
+    bool whole = true;
+
+    if (use_pipeline(attr)) {
+        // with --threads the windows are stat'ed by the pipeline's workers
+        // while the previous one is printed
+        stream_pipeline_t pipe(reader, window.dirfd, attr, stream_window);
+        while (pipe.next()) {
+            if (window.size() == stream_window) {
+                flush_window(window, attr, out);
+                pipe.window_done();
+                whole = false;
+            }
+            std::size_t i = pipe.add(window);
+            if (attr.recursive && descend_into(window, i))
+                subdirs.push_back(std::string(window.name[i], window.name_len[i]));
+        }
+    } else {
+        while (reader.next_batch()) {
+            while ((entry = reader.next()) != NULL) {
+                std::size_t len = std::strlen(entry->d_name);
+                if (skip_entry(entry->d_name, len, attr))
+                    continue;
+                if (window.size() == stream_window) {
+                    flush_window(window, attr, out);
+                    whole = false;
+                }
+                std::size_t i = window.add(entry->d_name, len, entry->d_type);
+                if (attr.recursive && descend_into(window, i))
+                    subdirs.push_back(std::string(entry->d_name, len));
+            }
+        }
     }
+    apply_predicates(window, attr);
+    if (whole || window.size() > 0)
+        pretty_print(window, attr, out, NULL, whole);
+}
 
-    chdir(path_name.c_str());
+// reads, sorts and prints the directory open as dirfd, preceded by its
+// header under -R. table is scratch space, reset here; under -R the
+// subdirectories to descend into are appended to subdirs in listing order.
+void list_dir(int dirfd, dir_reader_t& reader, entry_table_t& table, std::vector<std::string>& subdirs,
+              const std::string& header, const ls_attr_t& attr, writer_t& out)
+{
+    const struct dirent64* entry;
+    long_widths_t widths = {{0}, 0};
+    bool pipelined = use_pipeline(attr);
+
+    table.clear();
+    table.dirfd = dirfd;
+    reader.attach(dirfd);
+    if (streaming(attr)) {
+        if (attr.recursive)
+            put_header(header, attr, out);
+        stream_dir(reader, table, subdirs, attr, out);
+        out.boundary();
+        return;
+    }
 
-    std::vector<std::string> collector;
-    while ((entry = readdir(dir)) != NULL) {
-        if (!attr.all && entry->d_name[0] == '.')
-            continue;
-        if (attr.ignore_backups && entry->d_name[0] == '~')
-            continue;
-        if (is_dir_file(entry->d_name) && (std::string(".") == entry->d_name || std::string("..") == entry->d_name))
-            collector.push_back(entry->d_name);
-        else if (is_reg_file(entry->d_name))
-            collector.push_back(entry->d_name);
-        else
-            collector.push_back(entry->d_name);
+    cache_slot_t slot;
+    {
+        phase_timer_t timer(PHASE_READ);
+        if (cache_load(dirfd, table, attr, slot)) {
+            // everything the saved listing was missing is stat'ed as usual
+            pipelined = false;
+        } else if (pipelined) {
+            pipeline_read(reader, table, attr, widths);
+        } else {
+            while (reader.next_batch()) {
+                while ((entry = reader.next()) != NULL) {
+                    std::size_t len = std::strlen(entry->d_name);
+                    if (skip_entry(entry->d_name, len, attr))
+                        continue;
+                    table.add(entry->d_name, len, entry->d_type);
+                }
+            }
+        }
     }
-    if (!attr.no_sort) {
-        std::sort(collector.begin(), collector.end());
-        std::stable_sort(collector.begin(), collector.end(), cmp);
+    // the predicates only decide what is listed: -R still walks every
+    // subdirectory, so those are set aside first, in directory order
+    entry_table_t walk;
+    bool filtered = attr.recursive && predicates_active(attr);
+    if (filtered) {
+        walk.dirfd = dirfd;
+        for (std::size_t i = 0; i < table.size(); ++i) {
+            if (descend_into(table, i))
+                walk.add_row(table, i);
+        }
     }
-    if (attr.reverse)
-        std::reverse(collector.begin(), collector.end());
+    // the predicates run before anything is sorted or measured, so the
+    // widths from the pipeline no longer fit if they dropped an entry
+    if (apply_predicates(table, attr))
+        pipelined = false;
+    sort_entries(table, attr);
 
     if (attr.recursive)
-        std::cout << std::string(old_entry) + "/" + path_name + ":\n";
-    pretty_print(collector, attr);
-    
-    // recursive
+        put_header(header, attr, out);
+    pretty_print(table, attr, out, pipelined ? &widths : NULL);
+    out.boundary();
+    cache_store(table, attr, slot);
+
     if (attr.recursive) {
-        for (int i = 0; i < collector.size(); ++i) {
-            if (is_lnk_file(collector[i]) || !is_dir_file(collector[i]) || collector[i] == "." || collector[i] == "..")
-                continue;
-            std::puts("");
-            walk_dir(collector[i], attr);
+        // in the order they would be listed without the predicates
+        entry_table_t& dirs = filtered ? walk : table;
+        if (filtered)
+            sort_entries(walk, attr);
+        for (std::size_t k = 0; k < dirs.size(); ++k) {
+            std::size_t i = dirs.order[k];
+            if (descend_into(dirs, i))
+                subdirs.push_back(std::string(dirs.name[i], dirs.name_len[i]));
         }
     }
+}
 
-    chdir(old_entry);
-    closedir(dir);
+// the -R descent skips . and .., symlinks and anything that is not a
+// directory
+bool descend_into(entry_table_t& t, std::size_t i)
+{
+    const char* name = t.name[i];
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        return false;
+    return !is_lnk_file(t, i) && is_dir_file(t, i);
 }
 
-void pretty_print(const std::vector<std::string>& files, const ls_attr_t& attr)
+// lists the directory on top of the stack (or, under --du, adds it to
+// du), then recurses into its subdirectories. Which ones to descend into
+// is settled before the first descent, so nothing here touches an fd the
+// stack may have recycled, and the table is free to be reused by the next
+// level.
+static void walk_tree(dir_stack_t& stack, dir_reader_t& reader, entry_table_t& table,
+                      const std::string& header, const ls_attr_t& attr, du_totals_t& du)
 {
-    struct predicate {
-        static bool P(const std::vector< std::vector<int> >& max_between, int size, int col) {
-            int s = 0, i;
-            for (i = 0; i + size - 1 < max_between.size(); i += size)
-                s += max_between[i][i + size - 1] + 2;
-            if (i < max_between.size())
-                s += max_between[i][max_between.size() - 1] + 1;
-            return s <= col;
+    std::vector<std::string> subdirs;
+    {
+        trace_dir_t scope(header);
+        if (attr.du)
+            du_dir(stack.top(), reader, table, subdirs, du);
+        else
+            list_dir(stack.top(), reader, table, subdirs, header, attr, stdout_writer);
+    }
+
+    for (int i = 0; i < subdirs.size(); ++i) {
+        if (!attr.du && attr.format == FORMAT_TEXT)
+            stdout_writer.put('\n');
+        if (!stack.push(subdirs[i], std::string())) {
+            std::printf("walk_dir\n");
+            std::perror("openat");
+            std::exit(1);
         }
-    };
+        du_totals_t sub = {0, 0, 0, 0};
+        walk_tree(stack, reader, table, stack.path, attr, sub);
+        du_add(du, sub);
+        stack.pop();
+    }
+    if (attr.du && !attr.summarize)
+        du_record(header, du);
+}
+
+// -R headers: the top one is relative to where we started, the ones
+// below it extend the directory's physical path (real)
+void root_headers(const std::string& path_name, std::string& header, std::string& real)
+{
+    char* cwd = getcwd(NULL, 0);
+    char* resolved = realpath(path_name.c_str(), NULL);
+    if (cwd == NULL || resolved == NULL) {
+        std::printf("walk_dir\n");
+        std::perror("realpath");
+        std::exit(1);
+    }
+    header = std::string(cwd) + "/" + path_name;
+    real = resolved;
+    std::free(cwd);
+    std::free(resolved);
+}
+
+void walk_dir(const std::string& path_name, const ls_attr_t& attr)
+{
+    if (attr.recursive && attr.threads > 1) {
+        parallel_walk(path_name, attr);
+        return;
+    }
+
+    // one reader and one table for the whole walk: each directory is read
+    // to the end before we descend
+    static dir_reader_t reader(attr.dir_buffer);
+    static entry_table_t table;
+    std::string header, real;
+    if (attr.recursive)
+        root_headers(path_name, header, real);
+    else
+        header = path_name;     // only --trace looks at it
+
+    dir_stack_t stack(dir_stack_t::default_max_open());
+    if (!stack.push(path_name, real)) {
+        std::printf("walk_dir\n");
+        std::perror("open");
+        std::exit(1);
+    }
+    du_totals_t du = {0, 0, 0, 0};
+    walk_tree(stack, reader, table, header, attr, du);
+    if (attr.summarize)
+        du_record(header, du);
+    if (attr.du)
+        du_report(stdout_writer, attr);
+}
 
+// width pass of -l for a single entry; the pipeline runs it as entries
+// come back from the stat workers, pretty_print runs it over the vector
+void measure_long(entry_table_t& t, std::size_t i, long_widths_t& w)
+{
+    phase_timer_t timer(PHASE_LAYOUT, PHASE_TIMED);
+    entry_stat(t, i);
+    w.total_size += t.blocks[i];
+    w.width[0] = std::max(w.width[0], static_cast<std::size_t>(std::log10(t.nlink[i]) + 1));
+    w.width[1] = std::max(w.width[1], user_name(t.uid[i]).length());
+    w.width[2] = std::max(w.width[2], group_name(t.gid[i]).length());
+    w.width[3] = std::max(w.width[3], static_cast<std::size_t>(std::log10(t.bytes[i]) + 1));
+}
+
+void pretty_print(entry_table_t& files, const ls_attr_t& attr, writer_t& out,
+                  const long_widths_t* measured, bool total)
+{
+    stats_count(STATS_ENTRIES, files.size());
+    if (attr.format == FORMAT_JSON) {
+        json_print(files, out);
+        return;
+    }
+    if (attr.format == FORMAT_BINARY) {
+        binary_print(files, out);
+        return;
+    }
     if (attr.long_format || attr.l_without_owner) {
-        std::size_t width[4] = {0}, total_size = 0;
-        struct stat buf;
-        for (int i = 0; i < files.size(); ++i) {
-            if (fstatat(AT_FDCWD, files[i].c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-                std::printf("pretty_print");
-                std::perror("stat");
-                std::exit(1);
-            }
-            total_size += buf.st_blocks;
-            width[0] = std::max(width[0], static_cast<std::size_t>(std::log10(buf.st_nlink) + 1));
-            width[1] = std::max(width[1], std::strlen(getpwuid(buf.st_uid)->pw_name));
-            width[2] = std::max(width[2], std::strlen(getgrgid(buf.st_gid)->gr_name));
-            width[3] = std::max(width[3], static_cast<std::size_t>(std::log10(buf.st_size) + 1));
+        long_widths_t w = {{0}, 0};
+        if (measured) {
+            w = *measured;
+        } else {
+            fill_stats(files);
+            phase_timer_t timer(PHASE_LAYOUT);
+            for (std::size_t i = 0; i < files.size(); ++i)
+                measure_long(files, i, w);
         }
-        std::cout << "total " << total_size / 2 << std::endl;
-        for (int i = 0; i < files.size(); ++i) {
-            if (fstatat(AT_FDCWD, files[i].c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-                std::printf("%s\t", files[i].c_str());
-                std::printf("pretty_print\n");
-                std::perror("stat");
-                std::exit(1);
-            }
+        phase_timer_t timer(PHASE_FORMAT);
+        // the widths keep printf's int conversion of the size_t values
+        const int width[4] = {
+            static_cast<int>(w.width[0]), static_cast<int>(w.width[1]),
+            static_cast<int>(w.width[2]), static_cast<int>(w.width[3])
+        };
+        if (total) {
+            out.put("total ");
+            out.num(w.total_size / 2);
+            out.put('\n');
+        }
+        for (std::size_t k = 0; k < files.size(); ++k) {
+            std::size_t i = files.order[k];
+            entry_stat(files, i);
+            mode_t st_mode = files.mode[i];
             if (attr.inode)
-                std::printf("%-8lu", buf.st_ino);
-
-            // print file's mode
-            if (S_ISLNK(buf.st_mode))
-                std::putchar('l');
-            else if (S_ISREG(buf.st_mode))
-                std::putchar('-');
-            else if (S_ISDIR(buf.st_mode))
-                std::putchar('d');
-            else if (S_ISCHR(buf.st_mode))
-                std::putchar('c');
-            else if (S_ISBLK(buf.st_mode))
-                std::putchar('b');
-            else if (S_ISFIFO(buf.st_mode))
-                std::putchar('f');
+                out.num(files.ino[i], -8);
+
+            // file's mode, then user's, group's and other's permission
+            char mode[11];
+            if (S_ISLNK(st_mode))
+                mode[0] = 'l';
+            else if (S_ISREG(st_mode))
+                mode[0] = '-';
+            else if (S_ISDIR(st_mode))
+                mode[0] = 'd';
+            else if (S_ISCHR(st_mode))
+                mode[0] = 'c';
+            else if (S_ISBLK(st_mode))
+                mode[0] = 'b';
+            else if (S_ISFIFO(st_mode))
+                mode[0] = 'f';
             else
-                std::putchar('?');
-
-            // print user's permission
-            std::putchar(buf.st_mode & S_IRUSR ? 'r' : '-');
-            std::putchar(buf.st_mode & S_IWUSR ? 'w' : '-');
-            std::putchar(buf.st_mode & S_IXUSR ? 'x' : '-');
-
-            // print group's permission
-            std::putchar(buf.st_mode & S_IRGRP ? 'r' : '-');
-            std::putchar(buf.st_mode & S_IWGRP ? 'w' : '-');
-            std::putchar(buf.st_mode & S_IXGRP ? 'x' : '-');
-
-            // print other's permission
-            std::putchar(buf.st_mode & S_IROTH ? 'r' : '-');
-            std::putchar(buf.st_mode & S_IWOTH ? 'w' : '-');
-            std::putchar(buf.st_mode & S_IXOTH ? 'x' : '-');
+                mode[0] = '?';
+            mode[1] = st_mode & S_IRUSR ? 'r' : '-';
+            mode[2] = st_mode & S_IWUSR ? 'w' : '-';
+            mode[3] = st_mode & S_IXUSR ? 'x' : '-';
+            mode[4] = st_mode & S_IRGRP ? 'r' : '-';
+            mode[5] = st_mode & S_IWGRP ? 'w' : '-';
+            mode[6] = st_mode & S_IXGRP ? 'x' : '-';
+            mode[7] = st_mode & S_IROTH ? 'r' : '-';
+            mode[8] = st_mode & S_IWOTH ? 'w' : '-';
+            mode[9] = st_mode & S_IXOTH ? 'x' : '-';
+            mode[10] = ' ';
+            out.put(mode, sizeof(mode));
 
-            std::putchar(' ');
             // print owner and group
-            std::printf("%*lu ", width[0], buf.st_nlink);
-            if (!attr.l_without_owner)
-                std::printf("%*s ", width[1], getpwuid(buf.st_uid)->pw_name);
-            if (!attr.l_without_group)
-                std::printf("%*s ", width[2], getgrgid(buf.st_gid)->gr_name);
-            if (buf.st_size != 0)
-                std::printf("%*ld", width[3], buf.st_size);
-            else
-                std::printf("%ld", buf.st_size);
+            out.num(files.nlink[i], width[0]);
+            out.put(' ');
+            if (!attr.l_without_owner) {
+                out.pad(user_name(files.uid[i]), width[1]);
+                out.put(' ');
+            }
+            if (!attr.l_without_group) {
+                out.pad(group_name(files.gid[i]), width[2]);
+                out.put(' ');
+            }
+            out.num(files.bytes[i], files.bytes[i] != 0 ? width[3] : 0);
 
             // time
-            std::string time = std::string(ctime(&buf.st_mtime));
-            time.pop_back();
-            std::cout << " " << time << " ";
+            out.put(' ');
+            put_time(out, files.mtime[i]);
+            out.put(' ');
 
             // file name
-            std::cout << files[i] << std::endl;
+            out.put(files.name[i], files.name_len[i]);
+            out.put('\n');
         }
         return;
     }
 
-    std::vector< std::vector<int> > max_between(files.size());
-    for (int i = 0; i < max_between.size(); ++i)
-        max_between[i].resize(files.size());
-
-    for (int i = 0; i < files.size(); ++i)
-        max_between[i][i] = files[i].length();
-    for (int len = 1; len < files.size(); ++len) {
-        for (int i = 0; i + len < files.size(); ++i) {
-            int j = i + len;
-            max_between[i][j] = std::max(static_cast<int>(std::max(files[i].length(), files[j].length())),
-                                         max_between[i + 1][j - 1]);
-        }
-    }
-
-    int size;
-    if (attr.one_column) {
-        size = files.size();
-    } else {
-        int l = 1, r = files.size(), mid;
-        while (l <= r) {
-            mid = l + (r - l) / 2;
-            if (predicate::P(max_between, mid, get_screen_col())) {
-                r = mid - 1;
-                size = mid;
-            } else {
-                l = mid + 1;
-            }
+    // layout only needs the names' display widths, in listing order
+    std::vector<int> widths(files.size()), col_width;
+    std::size_t size;
+    {
+        phase_timer_t timer(PHASE_LAYOUT);
+        for (std::size_t k = 0; k < files.size(); ++k) {
+            std::size_t i = files.order[k];
+            widths[k] = display_width(files.name[i], files.name_len[i]);
         }
+        size = attr.one_column ? files.size() : layout_rows(widths, screen_cols());
+        column_widths(widths, size, col_width);
     }
 
-    for (int i = 0; i < size; ++i) {
-        for (int j = i, c = 0; j < files.size(); j += size, ++c) {
+    phase_timer_t timer(PHASE_FORMAT);
+    for (std::size_t i = 0; i < size; ++i) {
+        for (std::size_t j = i, c = 0; j < files.size(); j += size, ++c) {
             int extra_width = (j + size < files.size()) ? 2 : 1;
-            int end = std::min(static_cast<std::size_t>(c * size + size - 1), files.size() - 1);
-            std::printf("%*s", -(max_between[c * size][end] + extra_width), files[j].c_str());
+            std::size_t e = files.order[j];
+            out.pad(files.name[e], files.name_len[e], widths[j], -(col_width[c] + extra_width));
         }
-        std::puts("");
+        out.put('\n');
     }
 }
 
-
 void display_usage()
 {
-    std::printf("Usage：ls [options]... [file]...\n"
+    stdout_writer.put("Usage：ls [options]... [file]...\n"
                 "List information about the FILEs (the current directory by default).\n"
                 "\n"
                 "Options:\n"
@@ -302,61 +721,102 @@ void display_usage()
                 "-l         use a long listing format\n"
                 "-r         reverse order while sorting\n"
                 "-R         list subdirectories recursively\n"
-                "-S         sort by file size\n"
+                "-S         sort by file size, largest first\n"
+                "-t         sort by modification time, newest first\n"
+                "-U         do not sort; list entries in directory order\n"
+                "-v         natural sort of (version) numbers within text\n"
+                "-X         sort alphabetically by entry extension\n"
                 "-1         list one file per line\n"
                 "-B         do not list implied entries ending with ~\n"
+                "-I, --ignore=PATTERN\n"
+                "           do not list implied entries matching shell\n"
+                "             PATTERN\n"
+                "--hide=PATTERN\n"
+                "           do not list implied entries matching shell\n"
+                "             PATTERN (overridden by -a)\n"
                 "-f         do not sort, enable -aU, disable -ls --color\n"
                 "-g         like -l, but do not list owner\n"
-                "-G         in a long listing, don't print group names\n");
+                "-G         in a long listing, don't print group names\n"
+                "-n         like -l, but list numeric user and group IDs\n"
+                "--min-size=SIZE, --max-size=SIZE\n"
+                "           list only entries of at least or at most SIZE\n"
+                "             bytes (K, M, G suffixes)\n"
+                "--newer-than=WHEN, --older-than=WHEN\n"
+                "           list only entries modified after or before WHEN:\n"
+                "             an age (30m, 12h, 7d, 2w; days by default),\n"
+                "             @SECONDS or YYYY-MM-DD [HH:MM[:SS]]\n"
+                "--type=TYPES\n"
+                "           list only entries of these types: f, d, l, b,\n"
+                "             c, p, s (as find -type, e.g. --type=f,l)\n"
+                "--uid=USER\n"
+                "           list only entries owned by USER (name or id)\n"
+                "--dir-buffer=SIZE\n"
+                "           read directories SIZE bytes per getdents64 call\n"
+                "             (K, M, G suffixes; default 1M)\n"
+                "--cached-attrs\n"
+                "           trust locally cached attributes instead of\n"
+                "             revalidating them (network filesystems)\n"
+                "--stat-engine=WORD\n"
+                "           sync (default) or uring: batch a directory's\n"
+                "             statx calls through io_uring\n"
+                "--threads=N\n"
+                "           with -l or -S, overlap reading, statx and\n"
+                "             formatting using N stat workers; with -R,\n"
+                "             walk the tree with N threads\n"
+                "--load-ids\n"
+                "           read /etc/passwd and /etc/group once up front\n"
+                "             instead of asking NSS for every new id\n"
+                "--time-style=STYLE\n"
+                "           how -l shows times: ctime (default), locale,\n"
+                "             iso, long-iso or full-iso\n"
+                "--du\n"
+                "           instead of listing, total the 1K blocks, bytes,\n"
+                "             files and directories under every directory\n"
+                "             (hard links once, hidden files included) and\n"
+                "             print the totals largest first\n"
+                "--summarize\n"
+                "           like --du, but only for each operand\n"
+                "--format=WORD\n"
+                "           text (default); json: one JSON object per\n"
+                "             entry and per -R directory, with raw metadata;\n"
+                "             binary: fixed size records, see lsbin.hpp\n"
+                "--stats\n"
+                "           on exit, print syscall counts, bytes and entries\n"
+                "             read and written, name and output buffer\n"
+                "             allocations, and the time spent reading,\n"
+                "             stat'ing, sorting, laying out, formatting and\n"
+                "             writing (summed over threads) to stderr\n"
+                "--trace=FILE\n"
+                "           write a Chrome trace (chrome://tracing, Perfetto)\n"
+                "             of every directory listed and of the phases\n"
+                "             --stats times, per thread, to FILE\n"
+                "--cache[=DIR]\n"
+                "           reuse listings saved by earlier runs while the\n"
+                "             directory's mtime and ctime are unchanged\n"
+                "             (DIR defaults to $XDG_CACHE_HOME/ls, then\n"
+                "             ~/.cache/ls)\n"
+                "--no-cache\n"
+                "           do not use the listing cache\n"
+                "--refresh\n"
+                "           with --cache, ignore saved listings and save\n"
+                "             fresh ones\n"
+                "--cache-stats\n"
+                "           print cache hits and misses to stderr\n");
 }
 
-bool is_reg_file(const std::string& name)
+// "64K", "1M", "4096" -> bytes
+std::size_t parse_size(const char* s)
 {
-    struct stat buf;
-    if (fstatat(AT_FDCWD, name.c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-        std::printf("is_reg_file\n");
-        std::perror("stat");
-        std::exit(1);
-    }
-    return S_ISREG(buf.st_mode);
-}
-
-bool is_dir_file(const std::string& name)
-{
-    struct stat buf;
-    if (fstatat(AT_FDCWD, name.c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-        std::printf("is_dir_file\n");
-        std::printf("%s\n", name.c_str());
-        std::perror("stat");
-        std::exit(1);
-    }
-    return S_ISDIR(buf.st_mode);
-}
-
-bool is_lnk_file(const std::string& name)
-{
-    struct stat buf;
-    if (fstatat(AT_FDCWD, name.c_str(), &buf, AT_SYMLINK_NOFOLLOW) == -1) {
-        std::printf("is_lnk_file\n");
-        std::printf("%s\n", name.c_str());
-        std::perror("stat");
-        std::exit(1);
-    }
-    return S_ISLNK(buf.st_mode);
-}
-
-bool size_cmp(const std::string& file1, const std::string& file2)
-{
-    struct stat buf1, buf2;
-    if (fstatat(AT_FDCWD, file1.c_str(), &buf1, AT_SYMLINK_NOFOLLOW) == -1) {
-        std::printf("size_cmp\n");
-        std::perror("stat");
-        std::exit(1);
+    char* end;
+    unsigned long long n = std::strtoull(s, &end, 10);
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; // fall through
+    case 'M': case 'm': n <<= 10; // fall through
+    case 'K': case 'k': n <<= 10; ++end; break;
     }
-    if (stat(file2.c_str(), &buf2) == -1) {
-        std::printf("size_cmp");
-        std::perror("stat");
+    if (end == s || *end != '\0') {
+        std::fprintf(stderr, "ls: invalid size '%s'\n", s);
         std::exit(1);
     }
-    return buf1.st_size > buf2.st_size;
+    return n;
 }
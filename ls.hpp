@@ -12,33 +12,53 @@
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <cerrno>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 #include <grp.h>
 #include <pwd.h>
 
-static inline int get_screen_col()
+static inline int query_screen_col()
 {
-    int col;
+    int col = 0;
 #ifdef TIOCGSIZE
     struct ttysize ts;
-    ioctl(STDIN_FILENO, TIOCGSIZE, &ts);
-    col = ts.ts_cols;
+    if (ioctl(STDIN_FILENO, TIOCGSIZE, &ts) == 0)
+        col = ts.ts_cols;
 #elif defined TIOCGWINSZ
     struct winsize ts;
-    ioctl(STDIN_FILENO, TIOCGWINSZ, &ts);
-    col = ts.ws_col;
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ts) == 0)
+        col = ts.ws_col;
 #endif
     return col;
 }
 
+// --min-size, --max-size, --newer-than, --older-than, --type and --uid:
+// which entries of a directory are listed at all
+struct predicates_t {
+    unsigned int types;     // 1 << (S_IFMT bits >> 12) per wanted type; 0 is any
+    bool min_size, max_size, newer, older, owner;
+    unsigned long long min_bytes, max_bytes;
+    time_t newer_than, older_than;
+    uid_t uid;
+};
+
 struct ls_attr_t {
     unsigned int all: 1;
     unsigned int dir: 1;
@@ -46,24 +66,557 @@ struct ls_attr_t {
     unsigned int long_format: 1;
     unsigned int reverse: 1;
     unsigned int recursive: 1;
-    unsigned int sort_by_size: 1;
     unsigned int one_column: 1;
     unsigned int no_sort: 1;
     unsigned int l_without_owner: 1;
     unsigned int l_without_group: 1;
     unsigned int ignore_backups: 1;
+    unsigned int cached_attrs: 1;
+    unsigned int stat_uring: 1;
+    unsigned int numeric_ids: 1;
+    unsigned int load_ids: 1;
+    unsigned int du: 1;
+    unsigned int summarize: 1;
+    unsigned int cache: 1;
+    unsigned int cache_refresh: 1;
+    unsigned int cache_stats: 1;
+    unsigned int stats: 1;
+
+    std::size_t dir_buffer;
+    int threads;
+    int time_style;
+    int sort;
+    int format;
+    predicates_t pred;
+};
+
+// what a listing is sorted by; the last of -S, -t, -X, -v wins
+enum {
+    SORT_NAME,
+    SORT_SIZE,
+    SORT_TIME,
+    SORT_EXTENSION,
+    SORT_VERSION
+};
+
+// --format values
+enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_BINARY
+};
+
+// --time-style values; parse_time_style() relies on the order
+enum {
+    TIME_CTIME,
+    TIME_LOCALE,
+    TIME_ISO,
+    TIME_LONG_ISO,
+    TIME_FULL_ISO
+};
+
+// --stats: what the run asked of the kernel, how much it read and wrote,
+// and where the time went. Everything is a no-op until stats_init() turns
+// it on.
+enum {
+    STATS_STATX,        // per entry: statx, fstatat, io_uring statx ops
+    STATS_FSTAT,        // of directories
+    STATS_GETDENTS,
+    STATS_DIRENT_BYTES,
+    STATS_DIRENTS,
+    STATS_OPEN_DIR,
+    STATS_URING_ENTER,
+    STATS_NSS,
+    STATS_WRITE,
+    STATS_WRITE_BYTES,
+    STATS_ENTRIES,      // listed, or added up by --du
+    STATS_ALLOCS,       // name arena chunks and long names, writer buffers
+    STATS_ALLOC_BYTES,
+    STATS_COUNTERS
+};
+
+enum {
+    PHASE_READ,
+    PHASE_META,
+    PHASE_SORT,
+    PHASE_LAYOUT,
+    PHASE_FORMAT,
+    PHASE_OUTPUT,
+    PHASE_COUNT
+};
+
+// what a phase_timer_t does with its scope
+enum {
+    PHASE_TIMED = 1,    // adds it to the --stats phase times
+    PHASE_TRACED = 2    // writes it as a --trace event
+};
+
+extern bool stats_enabled, trace_enabled;
+extern std::atomic<unsigned long> stats_counters[STATS_COUNTERS];
+
+static inline long long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline void stats_count(int counter, unsigned long n = 1)
+{
+    if (stats_enabled)
+        stats_counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+// times the scope it lives in as one phase. Phases nest: while an inner
+// timer runs, the outer one is paused, so every nanosecond lands in
+// exactly one phase. Times add up over threads. Under --trace the scope
+// is also a begin/end event, unless it is one of the per-entry timers
+// (PHASE_TIMED only), which would bury the trace. A PHASE_TRACED only
+// timer marks a span in the trace without counting or pausing anything,
+// for scopes that mostly wait.
+class phase_timer_t {
+public:
+    explicit phase_timer_t(int p, int h = PHASE_TIMED | PHASE_TRACED) : phase(p), how(h), parent(NULL), start(0) {
+        if (stats_enabled || trace_enabled)
+            enter();
+    }
+    ~phase_timer_t() {
+        if (stats_enabled || trace_enabled)
+            leave();
+    }
+
+private:
+    phase_timer_t(const phase_timer_t&);
+    phase_timer_t& operator=(const phase_timer_t&);
+
+    void enter();
+    void leave();
+
+    int phase;
+    int how;
+    phase_timer_t* parent;
+    long long start;
+};
+
+void stats_init(const ls_attr_t&);
+void stats_report();
+
+// --trace=FILE: per-thread event buffers, written out as Chrome trace
+// JSON by trace_write() once every thread has finished
+void trace_init(const char*);
+void trace_phase(char, int, long long);
+void trace_write();
+
+// one directory's listing as a --trace event spanning its scope
+class trace_dir_t {
+public:
+    explicit trace_dir_t(const std::string& path) {
+        if (trace_enabled)
+            begin(path);
+    }
+    ~trace_dir_t() {
+        if (trace_enabled)
+            end();
+    }
+
+private:
+    trace_dir_t(const trace_dir_t&);
+    trace_dir_t& operator=(const trace_dir_t&);
+
+    void begin(const std::string&);
+    void end();
+};
+
+// reads a directory with raw getdents64 into one large buffer. The same
+// reader (and buffer) is reused for every directory of a -R walk; each
+// next_batch() call is one syscall worth of entries. The caller owns the
+// directory fd.
+class dir_reader_t {
+public:
+    explicit dir_reader_t(std::size_t buf_size);
+
+    void attach(int fd);
+
+    bool next_batch();
+    const struct dirent64* next();
+
+private:
+    dir_reader_t(const dir_reader_t&);
+    dir_reader_t& operator=(const dir_reader_t&);
+
+    std::vector<char> buf;
+    int fd;
+    std::size_t len, pos;
+};
+
+// bump allocator for entry names. Names are copied in NUL-terminated and
+// stay put until reset(), which keeps the chunks for the next directory.
+class name_arena_t {
+public:
+    name_arena_t();
+    ~name_arena_t();
+
+    const char* add(const char*, std::size_t);
+    void reset();
+
+private:
+    name_arena_t(const name_arena_t&);
+    name_arena_t& operator=(const name_arena_t&);
+
+    static const std::size_t chunk_size = 64 << 10;
+
+    std::vector<char*> chunks;      // chunk_size each, reused
+    std::vector<char*> oversized;   // one name each, freed by reset()
+    std::size_t cur, used;
+};
+
+// The entries of one listing as parallel columns indexed by entry id:
+// names live in the arena, everything statx can tell us in its own
+// column. The stat columns are only allocated once the first entry is
+// stat'ed, and are valid for entry i when has_stat[i] is set. d_type comes
+// for free from getdents and answers file type questions without any
+// stat. Names are relative to dirfd, which is AT_FDCWD for command line
+// operands. order is the listing order: insertion order until
+// sort_entries() rewrites it.
+class entry_table_t {
+public:
+    entry_table_t() : dirfd(AT_FDCWD) {}
+
+    std::size_t size() const { return name.size(); }
+    std::size_t add(const char*, std::size_t, unsigned char d_type = DT_UNKNOWN);
+    std::size_t add_interned(const char*, std::size_t, unsigned char);
+    void add_row(const entry_table_t&, std::size_t);
+    void set_stat(std::size_t, const struct stat&);
+    void keep(const std::vector<unsigned char>&);
+    void clear();
+
+    int dirfd;
+    name_arena_t names;
+
+    std::vector<const char*> name;
+    std::vector<unsigned int> name_len;
+    std::vector<unsigned char> d_type;
+    std::vector<unsigned char> has_stat;
+
+    std::vector<mode_t> mode;
+    std::vector<nlink_t> nlink;
+    std::vector<uid_t> uid;
+    std::vector<gid_t> gid;
+    std::vector<off_t> bytes;
+    std::vector<blkcnt_t> blocks;
+    std::vector<struct timespec> mtime;
+    std::vector<struct timespec> atime;
+    std::vector<struct timespec> ctime;
+    std::vector<ino_t> ino;
+    std::vector<dev_t> dev;
+
+    std::vector<unsigned int> order;
+
+private:
+    entry_table_t(const entry_table_t&);
+    entry_table_t& operator=(const entry_table_t&);
+};
+
+unsigned int meta_mask_for(const ls_attr_t&);
+void meta_init(const ls_attr_t&);
+void statx_to_stat(const struct statx&, struct stat&);
+void name_stat(int, const char*, struct stat&);
+void entry_stat(entry_table_t&, std::size_t);
+mode_t entry_type(entry_table_t&, std::size_t);
+void fill_stats(entry_table_t&);
+
+bool is_dir_file(entry_table_t&, std::size_t);
+bool is_reg_file(entry_table_t&, std::size_t);
+bool is_lnk_file(entry_table_t&, std::size_t);
+
+bool uring_init(unsigned int);
+void uring_fill_stats(entry_table_t&, unsigned int, int);
+
+// The chain of directories from a walk's root down to the one being
+// listed, each opened relative to its parent. At most max_open of their
+// fds stay open; the shallowest ones are closed first and reopened on the
+// way back up. path is the -R header of the top level.
+class dir_stack_t {
+public:
+    explicit dir_stack_t(int max_open);
+    ~dir_stack_t();
+
+    static int default_max_open();
+
+    bool push(const std::string& name, const std::string& display);
+    void pop();
+    int top();
+
+    std::string path;
+
+private:
+    dir_stack_t(const dir_stack_t&);
+    dir_stack_t& operator=(const dir_stack_t&);
+
+    struct level_t {
+        std::string name;
+        int fd;
+        dev_t dev;
+        ino_t ino;
+        std::size_t path_len;
+    };
+
+    void evict();
+    void reopen(std::size_t);
+
+    std::vector<level_t> levels;
+    int max_open, open_count;
+};
+
+// column widths and block total of a -l listing
+struct long_widths_t {
+    std::size_t width[4];
+    std::size_t total_size;
+};
+
+// bounded lock-free ring between exactly one producer and one consumer
+// thread. Capacity must be a power of two. push() and pop() yield a few
+// times when the ring is full or empty, then sleep on a condition
+// variable until the other side makes progress; the other side only takes
+// the lock when it sees someone asleep.
+template <typename T>
+class spsc_queue_t {
+public:
+    explicit spsc_queue_t(std::size_t capacity)
+        : slots(capacity), mask(capacity - 1), head(0), tail(0), closed(false),
+          push_waits(false), pop_waits(false) {}
+
+    bool try_push(T& v) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t & mask] = std::move(v);
+        tail.store(t + 1, std::memory_order_release);
+        wake(pop_waits);
+        return true;
+    }
+
+    bool try_pop(T& v) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        v = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        wake(push_waits);
+        return true;
+    }
+
+    void push(T& v) {
+        for (int spins = 0; !try_push(v); ++spins) {
+            if (spins < spin_limit) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            push_waits.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (full())
+                cv.wait(guard);
+            push_waits.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // false once the producer has closed the queue and it is drained
+    bool pop(T& v) {
+        for (int spins = 0; !try_pop(v); ++spins) {
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(v);
+            if (spins < spin_limit) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            pop_waits.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (empty() && !closed.load(std::memory_order_acquire))
+                cv.wait(guard);
+            pop_waits.store(false, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void close() {
+        closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> guard(lock);
+        cv.notify_all();
+    }
+
+private:
+    static const int spin_limit = 64;
+
+    bool full() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == slots.size();
+    }
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    // after publishing a slot: if the other side went to sleep before
+    // seeing it, take the lock (so it is really waiting) and wake it
+    void wake(std::atomic<bool>& waits) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waits.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> guard(lock);
+            cv.notify_one();
+        }
+    }
+
+    std::vector<T> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+    alignas(64) std::atomic<bool> closed;
+    std::atomic<bool> push_waits, pop_waits;
+    std::mutex lock;
+    std::condition_variable cv;
 };
 
-inline bool is_dir_file(const std::string&);
-inline bool is_reg_file(const std::string&);
-inline bool is_lnk_file(const std::string&);
+// Everything ls prints goes through a writer_t: one large buffer handed
+// to write(2) when it fills up, at directory boundaries when stdout is a
+// terminal, and at exit. A writer with fd -1 only grows; the parallel -R
+// walk lists each directory into one and the stitcher copies it out.
+class writer_t {
+public:
+    explicit writer_t(int fd, std::size_t capacity = 1 << 18);
+    ~writer_t();
 
-inline bool size_cmp(const std::string&, const std::string&);
+    void put(char c) {
+        if (len == buf.size())
+            make_room(1);
+        buf[len++] = c;
+    }
+    void put(const char*, std::size_t);
+    void put(const char* s) { put(s, std::strlen(s)); }
+    void put(const std::string& s) { put(s.data(), s.size()); }
+    void put(const writer_t&);
 
-void list_all_files(const std::vector<std::string>&, const ls_attr_t&);
+    // what printf's "%*s" and "%*llu" print: right-aligned in width
+    // columns, left-aligned in -width columns when width is negative.
+    // cols is how many columns the text takes on screen, if that is not
+    // its length.
+    void pad(const char* s, std::size_t n, int width) { pad(s, n, n, width); }
+    void pad(const char*, std::size_t, std::size_t cols, int width);
+    void pad(const std::string& s, int width) { pad(s.data(), s.size(), width); }
+    void num(unsigned long long, int width = 0);
+
+    void flush();
+    void boundary();
+    std::size_t size() const { return len; }
+    std::size_t capacity() const { return buf.size(); }
+
+private:
+    writer_t(const writer_t&);
+    writer_t& operator=(const writer_t&);
+
+    void make_room(std::size_t);
+    void spaces(std::size_t);
+
+    std::vector<char> buf;
+    std::size_t len;
+    int fd;
+    bool tty;
+};
+
+extern writer_t stdout_writer;
+
+// what cache_load() found out about a directory, for cache_store()
+struct cache_slot_t {
+    bool active;
+    bool hit;
+    struct stat dir;
+    std::size_t stats;
+};
+
+void cache_init(const ls_attr_t&, const char*);
+bool cache_load(int, entry_table_t&, const ls_attr_t&, cache_slot_t&);
+void cache_store(const entry_table_t&, const ls_attr_t&, const cache_slot_t&);
+void cache_counters(unsigned long&, unsigned long&, unsigned long&);
+
+bool use_pipeline(const ls_attr_t&);
+void pipeline_read(dir_reader_t&, entry_table_t&, const ls_attr_t&, long_widths_t&);
+
+// pipeline_read() for a streamed listing: next() waits for the
+// directory's next entry, stat'ed and in getdents order, and add() puts it
+// in a table. The names live in the pipeline, and a window's names stay
+// valid until window_done() has been called for the window after it.
+class stream_pipeline_t {
+public:
+    stream_pipeline_t(dir_reader_t&, int, const ls_attr_t&, std::size_t);
+    ~stream_pipeline_t();
+
+    bool next();
+    std::size_t add(entry_table_t&);
+    void window_done();
+
+private:
+    stream_pipeline_t(const stream_pipeline_t&);
+    stream_pipeline_t& operator=(const stream_pipeline_t&);
+
+    struct state_t;
+    state_t* s;
+};
+
+void parallel_walk(const std::string&, const ls_attr_t&);
+
+// what --du adds up per directory
+struct du_totals_t {
+    unsigned long long blocks, bytes, files, dirs;
+};
+
+void du_add(du_totals_t&, const du_totals_t&);
+void du_dir(int, dir_reader_t&, entry_table_t&, std::vector<std::string>&, du_totals_t&);
+void du_record(const std::string&, const du_totals_t&);
+void du_report(writer_t&, const ls_attr_t&);
+
+void json_string(writer_t&, const char*, std::size_t);
+void json_dir(writer_t&, const std::string&);
+void json_print(entry_table_t&, writer_t&);
+void json_du(writer_t&, const std::string&, const du_totals_t&);
+
+void binary_header(writer_t&);
+void binary_dir(writer_t&, const std::string&);
+void binary_print(entry_table_t&, writer_t&);
+
+void filter_init(const ls_attr_t&, const std::vector<std::string>&, const std::vector<std::string>&);
+bool filter_match(const char*, std::size_t);
+unsigned int filter_fingerprint();
+bool parse_types(const char*, unsigned int&);
+bool parse_when(const char*, time_t&);
+bool parse_owner(const char*, uid_t&);
+bool predicates_active(const ls_attr_t&);
+bool apply_predicates(entry_table_t&, const ls_attr_t&);
+
+void sort_entries(entry_table_t&, const ls_attr_t&);
+void list_all_files(entry_table_t&, const ls_attr_t&);
+bool skip_entry(const char*, std::size_t, const ls_attr_t&);
+bool streaming(const ls_attr_t&);
+void list_dir(int, dir_reader_t&, entry_table_t&, std::vector<std::string>&, const std::string&,
+              const ls_attr_t&, writer_t&);
+bool descend_into(entry_table_t&, std::size_t);
+void root_headers(const std::string&, std::string&, std::string&);
 void walk_dir(const std::string&, const ls_attr_t&);
-void pretty_print(const std::vector<std::string>&, const ls_attr_t&);
+void measure_long(entry_table_t&, std::size_t, long_widths_t&);
+void pretty_print(entry_table_t&, const ls_attr_t&, writer_t&, const long_widths_t* = NULL, bool = true);
+
+int screen_cols();
+std::size_t layout_rows(const std::vector<int>&, int);
+void column_widths(const std::vector<int>&, std::size_t, std::vector<int>&);
+int display_width(const char*, std::size_t);
+
+void id_cache_init(const ls_attr_t&);
+const std::string& user_name(uid_t);
+const std::string& group_name(gid_t);
+
+void time_init(const ls_attr_t&);
+bool parse_time_style(const char*, int&);
+void put_time(writer_t&, const struct timespec&);
 
+std::size_t parse_size(const char*);
 void display_usage();
 
 #endif
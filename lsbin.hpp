@@ -0,0 +1,136 @@
+#ifndef _LSBIN_INCLUDED_H_
+#define _LSBIN_INCLUDED_H_
+
+// The layout of ls --format=binary, and a reader for it. This header
+// stands alone so consumers can include it without the rest of ls.
+//
+// A stream is one lsbin_header_t followed by segments. Each segment starts
+// with an lsbin_segment_t:
+//
+//   LSBIN_DIR      names_size bytes of path: the entries segments that
+//                  follow, up to the next LSBIN_DIR, are in that directory
+//                  (what the text listing prints as a -R header).
+//                  Entries before the first LSBIN_DIR are the file
+//                  operands from the command line
+//   LSBIN_ENTRIES  count fixed size lsbin_record_t, then a heap of
+//                  names_size bytes holding their NUL-terminated names
+//
+// and is padded to a multiple of 8 bytes, so every header and record is
+// aligned when the whole stream is mapped. A directory may be split over
+// several entries segments (-f writes one per window). Integers are in
+// the byte order of the machine that wrote the stream; byte_order tells
+// a reader whether that is its own.
+//
+//   lsbin_reader_t r;
+//   lsbin_segment_view_t seg;
+//   if (lsbin_open(r, map, size))
+//       while (lsbin_next(r, seg))
+//           for (uint32_t i = 0; i < seg.count; ++i)
+//               use(seg.records[i], lsbin_name(seg, seg.records[i]));
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+static const char lsbin_magic[8] = {'L', 'S', 'B', 'I', 'N', '\0', '\0', '\0'};
+static const uint32_t lsbin_version = 1;
+static const uint32_t lsbin_byte_order = 0x01020304;
+
+struct lsbin_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;   // sizeof(lsbin_header_t)
+    uint32_t record_size;   // sizeof(lsbin_record_t)
+};
+
+enum {
+    LSBIN_DIR = 1,
+    LSBIN_ENTRIES = 2
+};
+
+struct lsbin_segment_t {
+    uint32_t kind;
+    uint32_t count;
+    uint64_t names_size;
+};
+
+// one entry; times are nanoseconds since the epoch and name_off is the
+// offset of the name in its segment's heap
+struct lsbin_record_t {
+    uint64_t size, blocks, ino, dev, nlink;
+    int64_t atime_ns, mtime_ns, ctime_ns;
+    uint32_t mode, uid, gid;
+    uint32_t name_len;
+    uint64_t name_off;
+};
+
+static inline uint64_t lsbin_pad(uint64_t n)
+{
+    return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+struct lsbin_reader_t {
+    const char* pos;
+    const char* end;
+};
+
+struct lsbin_segment_view_t {
+    uint32_t kind;
+    uint32_t count;
+    const lsbin_record_t* records;  // LSBIN_ENTRIES
+    const char* names;              // the heap, or the LSBIN_DIR path
+    uint64_t names_size;
+};
+
+// checks the stream header; false if data is not a stream this reader
+// understands (other version, other byte order, truncated)
+static inline bool lsbin_open(lsbin_reader_t& r, const void* data, std::size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    if (size < sizeof(lsbin_header_t))
+        return false;
+    const lsbin_header_t* h = reinterpret_cast<const lsbin_header_t*>(p);
+    if (std::memcmp(h->magic, lsbin_magic, sizeof(lsbin_magic)) != 0 || h->version != lsbin_version ||
+        h->byte_order != lsbin_byte_order || h->header_size != sizeof(lsbin_header_t) ||
+        h->record_size != sizeof(lsbin_record_t))
+        return false;
+    r.pos = p + sizeof(lsbin_header_t);
+    r.end = p + size;
+    return true;
+}
+
+// the next segment; false at the end of the stream or at a segment that
+// does not fit in what is left of it
+static inline bool lsbin_next(lsbin_reader_t& r, lsbin_segment_view_t& seg)
+{
+    uint64_t left = r.end - r.pos;
+    if (left < sizeof(lsbin_segment_t))
+        return false;
+    const lsbin_segment_t* s = reinterpret_cast<const lsbin_segment_t*>(r.pos);
+    uint64_t records = s->kind == LSBIN_ENTRIES ? static_cast<uint64_t>(s->count) * sizeof(lsbin_record_t) : 0;
+    left -= sizeof(lsbin_segment_t);
+    if (s->names_size > left)
+        return false;
+    uint64_t names = lsbin_pad(s->names_size);
+    if (names > left || records > left - names)
+        return false;
+
+    seg.kind = s->kind;
+    seg.count = s->kind == LSBIN_ENTRIES ? s->count : 0;
+    seg.records = reinterpret_cast<const lsbin_record_t*>(r.pos + sizeof(lsbin_segment_t));
+    seg.names = r.pos + sizeof(lsbin_segment_t) + records;
+    seg.names_size = s->names_size;
+    r.pos = seg.names + names;
+    return true;
+}
+
+// NULL if the record's name lies outside its segment's heap
+static inline const char* lsbin_name(const lsbin_segment_view_t& seg, const lsbin_record_t& rec)
+{
+    if (rec.name_off >= seg.names_size || rec.name_len >= seg.names_size - rec.name_off)
+        return NULL;
+    return seg.names + rec.name_off;
+}
+
+#endif
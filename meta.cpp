@@ -0,0 +1,142 @@
+#include "ls.hpp"
+
+// what every entry_stat() call asks the kernel for; set once by meta_init
+static unsigned int meta_mask = 0;
+static int meta_flags = AT_SYMLINK_NOFOLLOW;
+// cleared by whichever thread first finds statx missing
+static std::atomic<bool> have_statx(true);
+static bool use_uring = false;
+
+// smallest STATX_* mask that covers what the listing will print or sort on
+unsigned int meta_mask_for(const ls_attr_t& attr)
+{
+    unsigned int mask = STATX_TYPE;
+    if (attr.long_format || attr.l_without_owner)
+        mask |= STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_BLOCKS | STATX_MTIME;
+    if (attr.sort == SORT_SIZE)
+        mask |= STATX_SIZE;
+    if (attr.sort == SORT_TIME)
+        mask |= STATX_MTIME;
+    if (attr.inode)
+        mask |= STATX_INO;
+    if (attr.pred.min_size || attr.pred.max_size)
+        mask |= STATX_SIZE;
+    if (attr.pred.newer || attr.pred.older)
+        mask |= STATX_MTIME;
+    if (attr.pred.owner)
+        mask |= STATX_UID;
+    if (attr.format != FORMAT_TEXT)
+        mask |= STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_BLOCKS | STATX_INO |
+                STATX_ATIME | STATX_MTIME | STATX_CTIME;
+    if (attr.du)
+        mask |= STATX_MODE | STATX_NLINK | STATX_SIZE | STATX_BLOCKS | STATX_INO;
+    return mask;
+}
+
+void meta_init(const ls_attr_t& attr)
+{
+    meta_mask = meta_mask_for(attr);
+    if (attr.cached_attrs)
+        meta_flags |= AT_STATX_DONT_SYNC;
+    // silently stay synchronous when io_uring is missing or locked down
+    if (attr.stat_uring)
+        use_uring = uring_init(1024);
+}
+
+void statx_to_stat(const struct statx& sx, struct stat& st)
+{
+    std::memset(&st, 0, sizeof(st));
+    st.st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+    st.st_ino = sx.stx_ino;
+    st.st_mode = sx.stx_mode;
+    st.st_nlink = sx.stx_nlink;
+    st.st_uid = sx.stx_uid;
+    st.st_gid = sx.stx_gid;
+    st.st_rdev = makedev(sx.stx_rdev_major, sx.stx_rdev_minor);
+    st.st_size = sx.stx_size;
+    st.st_blksize = sx.stx_blksize;
+    st.st_blocks = sx.stx_blocks;
+    st.st_atim.tv_sec = sx.stx_atime.tv_sec;
+    st.st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+    st.st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+    st.st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+    st.st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+    st.st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+}
+
+// one metadata call per entry: statx with the run's mask, or plain lstat
+// on kernels (or filesystems) that do not know statx
+static int fetch_meta(int dirfd, const char* name, struct stat& st)
+{
+    stats_count(STATS_STATX);
+    if (have_statx.load(std::memory_order_relaxed)) {
+        struct statx sx;
+        if (statx(dirfd, name, meta_flags, meta_mask, &sx) == 0) {
+            statx_to_stat(sx, st);
+            return 0;
+        }
+        if (errno != ENOSYS && errno != EINVAL)
+            return -1;
+        have_statx.store(false, std::memory_order_relaxed);
+    }
+    return fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+}
+
+// metadata for dirfd/name, or a fatal error
+void name_stat(int dirfd, const char* name, struct stat& st)
+{
+    phase_timer_t timer(PHASE_META, PHASE_TIMED);
+    if (fetch_meta(dirfd, name, st) == -1) {
+        std::printf("entry_stat\n");
+        std::printf("%s\n", name);
+        std::perror("stat");
+        std::exit(1);
+    }
+}
+
+void entry_stat(entry_table_t& t, std::size_t i)
+{
+    if (!t.has_stat[i]) {
+        struct stat st;
+        name_stat(t.dirfd, t.name[i], st);
+        t.set_stat(i, st);
+    }
+}
+
+// batch point for everything that is going to need metadata anyway: with
+// the io_uring engine the whole table is in flight at once, and whatever
+// it could not stat goes through entry_stat() one by one
+void fill_stats(entry_table_t& t)
+{
+    phase_timer_t timer(PHASE_META);
+    if (use_uring && have_statx)
+        uring_fill_stats(t, meta_mask, meta_flags);
+    for (std::size_t i = 0; i < t.size(); ++i)
+        entry_stat(t, i);
+}
+
+// file type bits (S_IFMT part of st_mode), taken from d_type when the
+// filesystem filled it in and from statx otherwise
+mode_t entry_type(entry_table_t& t, std::size_t i)
+{
+    if (t.has_stat[i] || t.d_type[i] == DT_UNKNOWN) {
+        entry_stat(t, i);
+        return t.mode[i] & S_IFMT;
+    }
+    return DTTOIF(t.d_type[i]);
+}
+
+bool is_reg_file(entry_table_t& t, std::size_t i)
+{
+    return S_ISREG(entry_type(t, i));
+}
+
+bool is_dir_file(entry_table_t& t, std::size_t i)
+{
+    return S_ISDIR(entry_type(t, i));
+}
+
+bool is_lnk_file(entry_table_t& t, std::size_t i)
+{
+    return S_ISLNK(entry_type(t, i));
+}
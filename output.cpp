@@ -0,0 +1,136 @@
+#include "ls.hpp"
+
+#include <sys/uio.h>
+
+writer_t stdout_writer(STDOUT_FILENO);
+
+writer_t::writer_t(int out_fd, std::size_t capacity)
+    : buf(capacity), len(0), fd(out_fd), tty(out_fd != -1 && isatty(out_fd))
+{
+    if (capacity > 0) {
+        stats_count(STATS_ALLOCS);
+        stats_count(STATS_ALLOC_BYTES, capacity);
+    }
+}
+
+// whatever is still buffered at exit goes out here
+writer_t::~writer_t()
+{
+    flush();
+}
+
+// hand iov[0, cnt) to the fd, however many writev calls that takes
+static void write_all(int fd, struct iovec* iov, int cnt)
+{
+    phase_timer_t timer(PHASE_OUTPUT);
+    while (cnt > 0) {
+        stats_count(STATS_WRITE);
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            std::printf("writer_t::flush\n");
+            std::perror("writev");
+            std::exit(1);
+        }
+        stats_count(STATS_WRITE_BYTES, n);
+        while (cnt > 0 && static_cast<std::size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void writer_t::flush()
+{
+    if (fd == -1 || len == 0)
+        return;
+    struct iovec iov = {&buf[0], len};
+    // cleared first: if the write fails, exit() must not try again
+    len = 0;
+    write_all(fd, &iov, 1);
+}
+
+// a directory's listing is complete; someone watching a terminal should
+// see it now rather than when the buffer happens to fill
+void writer_t::boundary()
+{
+    if (tty)
+        flush();
+}
+
+// make at least n bytes available at the end of the buffer
+void writer_t::make_room(std::size_t n)
+{
+    if (fd == -1) {
+        // memory writers may start out empty; the first put allocates
+        std::size_t size = std::max(std::max(buf.size() * 2, len + n), static_cast<std::size_t>(512));
+        stats_count(STATS_ALLOCS);
+        stats_count(STATS_ALLOC_BYTES, size);
+        buf.resize(size);
+    } else
+        flush();
+}
+
+void writer_t::put(const char* s, std::size_t n)
+{
+    if (n > buf.size() - len) {
+        if (fd != -1 && n >= buf.size()) {
+            // too big to be worth copying: send both in one writev
+            struct iovec iov[2] = {{&buf[0], len}, {const_cast<char*>(s), n}};
+            len = 0;
+            write_all(fd, iov, 2);
+            return;
+        }
+        make_room(n);
+    }
+    std::memcpy(&buf[len], s, n);
+    len += n;
+}
+
+void writer_t::put(const writer_t& w)
+{
+    put(w.buf.data(), w.len);
+}
+
+void writer_t::spaces(std::size_t n)
+{
+    while (n > 0) {
+        if (len == buf.size())
+            make_room(1);
+        std::size_t k = std::min(n, buf.size() - len);
+        std::memset(&buf[len], ' ', k);
+        len += k;
+        n -= k;
+    }
+}
+
+void writer_t::pad(const char* s, std::size_t n, std::size_t cols, int width)
+{
+    if (width >= 0) {
+        if (static_cast<std::size_t>(width) > cols)
+            spaces(width - cols);
+        put(s, n);
+    } else {
+        put(s, n);
+        std::size_t w = -static_cast<long>(width);
+        if (w > cols)
+            spaces(w - cols);
+    }
+}
+
+void writer_t::num(unsigned long long v, int width)
+{
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    pad(p, digits + sizeof(digits) - p, width);
+}
@@ -0,0 +1,366 @@
+#include "ls.hpp"
+
+// Parallel -R. Every directory is a task; a worker lists it into its own
+// memory writer and queues one child task per subdirectory, in listing
+// order. Workers own a deque each: they push and pop at the back (depth
+// first, which keeps the stitcher fed) and steal from the front of the
+// others when they run dry. The calling thread walks the task tree in the
+// same pre-order the serial walk_dir uses and writes each buffer as soon
+// as it is done, so the output is byte-identical to a serial -R.
+//
+// A task opens its directory relative to its parent's fd. Parents keep
+// their fd open for their children while the walk is below its fd budget;
+// past it, they close it and children climb to the nearest ancestor that
+// still has one, then walk back down by name.
+//
+// Under --du a task adds its directory up instead of listing it, and the
+// stitcher sums the subtrees on its way back up.
+//
+// Output the stitcher has not reached yet waits in memory, so how far the
+// workers may run ahead is capped: past max_buffered bytes they stop
+// taking tasks until the stitcher catches up. The stitcher never waits on
+// a task nobody has started; it takes that one and lists it itself.
+
+struct dir_node_t {
+    dir_node_t* parent;
+    std::string name;
+    int fd;                     // -1 once given back to the budget
+    std::atomic<long> refs;     // the node's own task plus pending children
+};
+
+// memory held by listings done but not yet written out (their buffers and
+// the tasks themselves), summed over the walk
+static const std::size_t max_buffered = 8 << 20;
+
+struct dir_task_t {
+    dir_task_t() : out(-1, 0), taken(false) {}
+
+    dir_node_t* parent;     // NULL for the root, which is opened from the cwd
+    std::string name;
+    std::string real;       // physical path, what -R headers extend
+    std::string header;
+    writer_t out;           // allocates nothing until something is listed
+    du_totals_t du;
+    std::vector<dir_task_t*> children;
+    std::atomic<bool> taken;    // by a worker or the stitcher; runs once
+    std::atomic<int> refs;      // its deque slot and the stitcher
+    bool done;
+};
+
+struct work_deque_t {
+    std::mutex lock;
+    std::deque<dir_task_t*> tasks;
+};
+
+struct walk_pool_t {
+    const ls_attr_t* attr;
+    std::vector<work_deque_t*> deques;
+    std::atomic<long> pending;      // queued or running tasks
+    std::atomic<long> queued;       // tasks sitting in the deques
+    std::atomic<int> open_fds;
+    int max_open;
+    std::atomic<std::size_t> buffered;  // held() of the tasks done, not stitched
+
+    // workers with nothing to steal, or too far ahead, sleep here until a
+    // task is queued, the stitcher catches up or the walk is over
+    std::mutex idle_lock;
+    std::condition_variable idle_cv;
+
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+};
+
+static dir_task_t* new_task(dir_node_t* parent, const std::string& name, const std::string& real)
+{
+    dir_task_t* t = new dir_task_t;
+    t->parent = parent;
+    t->name = name;
+    t->real = real;
+    t->header = real;
+    t->du.blocks = t->du.bytes = t->du.files = t->du.dirs = 0;
+    t->refs.store(2);
+    t->done = false;
+    return t;
+}
+
+static std::size_t held(const dir_task_t* t)
+{
+    return sizeof(dir_task_t) + t->out.capacity() + t->name.capacity() + t->real.capacity() +
+           t->header.capacity();
+}
+
+// a task taken by the stitcher may still sit in a deque, so it goes away
+// once both the stitcher and its deque slot are done with it
+static void release_task(dir_task_t* t)
+{
+    if (t->refs.fetch_sub(1) == 1)
+        delete t;
+}
+
+static void release_node(walk_pool_t& pool, dir_node_t* n)
+{
+    while (n && n->refs.fetch_sub(1) == 1) {
+        dir_node_t* up = n->parent;
+        if (n->fd != -1) {
+            close(n->fd);
+            pool.open_fds.fetch_sub(1);
+        }
+        delete n;
+        n = up;
+    }
+}
+
+static int open_in(dir_node_t* dir, const std::string& name)
+{
+    if (!dir) {
+        stats_count(STATS_OPEN_DIR);
+        return open(name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    // the root always keeps its fd, so this stops before running off the top
+    std::vector<const std::string*> names(1, &name);
+    while (dir->fd == -1) {
+        names.push_back(&dir->name);
+        dir = dir->parent;
+    }
+    int base = dir->fd, fd = -1;
+    for (std::size_t i = names.size(); i-- > 0; ) {
+        stats_count(STATS_OPEN_DIR);
+        fd = openat(base, names[i]->c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (base != dir->fd)
+            close(base);
+        if (fd == -1)
+            break;
+        base = fd;
+    }
+    return fd;
+}
+
+// a task from the back of our own deque, or else from the front of
+// someone else's; tasks the stitcher already took are dropped on the way
+static dir_task_t* pop_task(walk_pool_t& pool, std::size_t self)
+{
+    for (std::size_t i = 0; i < pool.deques.size(); ++i) {
+        work_deque_t* d = pool.deques[(self + i) % pool.deques.size()];
+        std::lock_guard<std::mutex> guard(d->lock);
+        while (!d->tasks.empty()) {
+            dir_task_t* t = i == 0 ? d->tasks.back() : d->tasks.front();
+            if (i == 0)
+                d->tasks.pop_back();
+            else
+                d->tasks.pop_front();
+            pool.queued.fetch_sub(1);
+            // the stitcher holds t until it is done, so this is never the
+            // last reference to a task we go on to run
+            bool mine = !t->taken.exchange(true);
+            release_task(t);
+            if (mine)
+                return t;
+        }
+    }
+    return NULL;
+}
+
+// the stitcher's share of the cleanup: taken tasks at either end of a
+// deque, which workers held back by the cap would not pop for a while
+static void drop_taken(walk_pool_t& pool)
+{
+    for (std::size_t i = 0; i < pool.deques.size(); ++i) {
+        work_deque_t* d = pool.deques[i];
+        std::lock_guard<std::mutex> guard(d->lock);
+        while (!d->tasks.empty() && d->tasks.back()->taken.load()) {
+            release_task(d->tasks.back());
+            d->tasks.pop_back();
+            pool.queued.fetch_sub(1);
+        }
+        while (!d->tasks.empty() && d->tasks.front()->taken.load()) {
+            release_task(d->tasks.front());
+            d->tasks.pop_front();
+            pool.queued.fetch_sub(1);
+        }
+    }
+}
+
+static void run_task(walk_pool_t& pool, std::size_t self, dir_reader_t& reader, entry_table_t& table,
+                     dir_task_t* t)
+{
+    const ls_attr_t& attr = *pool.attr;
+    int fd = open_in(t->parent, t->name);
+    if (fd == -1) {
+        std::printf("walk_dir\n");
+        std::perror("open");
+        std::exit(1);
+    }
+    pool.open_fds.fetch_add(1);
+
+    // takes over the task's reference on its parent
+    dir_node_t* node = new dir_node_t;
+    node->parent = t->parent;
+    node->name = t->name;
+    node->fd = fd;
+    node->refs.store(1);
+
+    std::vector<std::string> subdirs;
+    {
+        trace_dir_t scope(t->header);
+        if (attr.du)
+            du_dir(fd, reader, table, subdirs, t->du);
+        else
+            list_dir(fd, reader, table, subdirs, t->header, attr, t->out);
+    }
+    pool.buffered.fetch_add(held(t));
+
+    std::vector<dir_task_t*> children;
+    for (std::size_t i = 0; i < subdirs.size(); ++i)
+        children.push_back(new_task(node, subdirs[i], t->real + "/" + subdirs[i]));
+    node->refs.fetch_add(children.size());
+    if (node->parent && (children.empty() || pool.open_fds.load() > pool.max_open)) {
+        close(fd);
+        node->fd = -1;
+        pool.open_fds.fetch_sub(1);
+    }
+    release_node(pool, node);
+
+    if (!children.empty()) {
+        pool.pending.fetch_add(children.size());
+        work_deque_t* own = pool.deques[self];
+        {
+            std::lock_guard<std::mutex> guard(own->lock);
+            for (std::size_t i = children.size(); i-- > 0; )
+                own->tasks.push_back(children[i]);
+        }
+        pool.queued.fetch_add(children.size());
+        // this worker takes one child itself; the others are for sleepers
+        if (children.size() > 1) {
+            std::lock_guard<std::mutex> guard(pool.idle_lock);
+            pool.idle_cv.notify_all();
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(pool.done_lock);
+    t->children.swap(children);
+    t->done = true;
+    pool.done_cv.notify_all();
+}
+
+static void finish_task(walk_pool_t& pool)
+{
+    if (pool.pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> guard(pool.idle_lock);
+        pool.idle_cv.notify_all();
+    }
+}
+
+static bool too_far_ahead(walk_pool_t& pool)
+{
+    return pool.buffered.load() >= max_buffered && pool.pending.load() != 0;
+}
+
+static void worker(walk_pool_t& pool, std::size_t self)
+{
+    dir_reader_t reader(pool.attr->dir_buffer);
+    entry_table_t table;
+    for (;;) {
+        if (too_far_ahead(pool)) {
+            std::unique_lock<std::mutex> guard(pool.idle_lock);
+            while (too_far_ahead(pool))
+                pool.idle_cv.wait(guard);
+            continue;
+        }
+        dir_task_t* t = pop_task(pool, self);
+        if (t) {
+            run_task(pool, self, reader, table, t);
+            finish_task(pool);
+        } else if (pool.pending.load() == 0) {
+            break;
+        } else {
+            std::unique_lock<std::mutex> guard(pool.idle_lock);
+            while (pool.queued.load() == 0 && pool.pending.load() != 0 && !too_far_ahead(pool))
+                pool.idle_cv.wait(guard);
+        }
+    }
+}
+
+// what the stitcher lists itself: its reader and table, and deque 0 for
+// the children
+struct stitcher_t {
+    explicit stitcher_t(walk_pool_t& p) : pool(p), reader(p.attr->dir_buffer) {}
+
+    walk_pool_t& pool;
+    dir_reader_t reader;
+    entry_table_t table;
+};
+
+// pre-order, like the serial walk: a directory, then a blank line and the
+// subtree of each subdirectory in listing order. Returns the subtree's
+// --du totals.
+static du_totals_t stitch(stitcher_t& s, dir_task_t* t)
+{
+    walk_pool_t& pool = s.pool;
+    const ls_attr_t& attr = *pool.attr;
+    if (!t->taken.exchange(true)) {
+        // still queued somewhere: the workers are busy or held back
+        run_task(pool, 0, s.reader, s.table, t);
+        finish_task(pool);
+        drop_taken(pool);
+    }
+    {
+        std::unique_lock<std::mutex> guard(pool.done_lock);
+        while (!t->done)
+            pool.done_cv.wait(guard);
+    }
+    stdout_writer.put(t->out);
+    stdout_writer.boundary();
+    std::size_t was = pool.buffered.fetch_sub(held(t));
+    if (was >= max_buffered && was - held(t) < max_buffered) {
+        std::lock_guard<std::mutex> guard(pool.idle_lock);
+        pool.idle_cv.notify_all();
+    }
+    du_totals_t du = t->du;
+    for (std::size_t i = 0; i < t->children.size(); ++i) {
+        if (!attr.du && attr.format == FORMAT_TEXT)
+            stdout_writer.put('\n');
+        du_add(du, stitch(s, t->children[i]));
+    }
+    if (attr.du && !attr.summarize)
+        du_record(t->header, du);
+    release_task(t);
+    return du;
+}
+
+void parallel_walk(const std::string& path_name, const ls_attr_t& attr)
+{
+    std::string header, real;
+    root_headers(path_name, header, real);
+    dir_task_t* root = new_task(NULL, path_name, real);
+    root->header = header;
+
+    walk_pool_t pool;
+    pool.attr = &attr;
+    pool.pending.store(1);
+    pool.queued.store(1);
+    pool.buffered.store(0);
+    pool.open_fds.store(0);
+    pool.max_open = dir_stack_t::default_max_open();
+    for (int i = 0; i < attr.threads; ++i)
+        pool.deques.push_back(new work_deque_t);
+    pool.deques[0]->tasks.push_back(root);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < attr.threads; ++i)
+        threads.push_back(std::thread(worker, std::ref(pool), i));
+
+    std::string root_header = root->header;
+    stitcher_t s(pool);
+    du_totals_t du = stitch(s, root);
+
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    for (std::size_t i = 0; i < pool.deques.size(); ++i)
+        delete pool.deques[i];
+
+    if (attr.summarize)
+        du_record(root_header, du);
+    if (attr.du)
+        du_report(stdout_writer, attr);
+}
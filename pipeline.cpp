@@ -0,0 +1,196 @@
+#include "ls.hpp"
+
+// Staged listing of one directory:
+//
+//   reader thread --(in[k])--> stat worker k --(out[k])--> formatter
+//
+// The reader deals entries out round-robin, so entry i always travels
+// through worker i % n, and the formatter (the calling thread) collects
+// them in the same round-robin order. Every queue has one producer and one
+// consumer, and the table is filled in getdents order no matter how the
+// workers are scheduled. Only the reader touches the table's name arena
+// and only the formatter its columns.
+//
+// A streamed listing (-f) goes through the same stages, but the formatter
+// prints and drops a window of entries at a time while the reader goes
+// on. There the reader keeps the names in two arenas of its own, one per
+// window in turn, and only recycles one once the formatter is done with
+// the window before last.
+
+static const std::size_t queue_capacity = 1024;
+
+// what travels through the queues: a name already in the table's arena,
+// and the stat worker's answer for it
+struct piped_entry_t {
+    const char* name;
+    unsigned int len;
+    unsigned char d_type;
+    struct stat st;
+};
+
+bool use_pipeline(const ls_attr_t& attr)
+{
+    // a parallel -R walk already keeps every thread busy
+    if (attr.threads < 2 || attr.stat_uring || attr.recursive)
+        return false;
+    return attr.long_format || attr.l_without_owner || attr.format != FORMAT_TEXT ||
+           attr.sort == SORT_SIZE || attr.sort == SORT_TIME;
+}
+
+// where the reader puts names: one arena for the whole directory, or two
+// taking turns per window of a streamed listing
+struct name_windows_t {
+    name_arena_t* arenas;
+    std::size_t window;         // entries per window; 0 for a single arena
+    std::mutex lock;
+    std::condition_variable cv;
+    std::size_t done;           // windows the formatter has finished with
+};
+
+static void read_stage(dir_reader_t& reader, name_windows_t& names, const ls_attr_t& attr,
+                       std::vector<spsc_queue_t<piped_entry_t>*>& in)
+{
+    const struct dirent64* d;
+    std::size_t i = 0, w = 0, in_window = 0;
+    piped_entry_t e;
+    while (reader.next_batch()) {
+        while ((d = reader.next()) != NULL) {
+            e.len = std::strlen(d->d_name);
+            if (skip_entry(d->d_name, e.len, attr))
+                continue;
+            if (names.window && in_window == names.window) {
+                // window w + 1 reuses the arena of window w - 1
+                ++w;
+                in_window = 0;
+                std::unique_lock<std::mutex> guard(names.lock);
+                while (names.done + 1 < w)
+                    names.cv.wait(guard);
+                names.arenas[w & 1].reset();
+            }
+            ++in_window;
+            e.name = names.arenas[w & 1].add(d->d_name, e.len);
+            e.d_type = d->d_type;
+            in[i++ % in.size()]->push(e);
+        }
+    }
+    for (std::size_t k = 0; k < in.size(); ++k)
+        in[k]->close();
+}
+
+static void stat_stage(int dirfd, spsc_queue_t<piped_entry_t>* in, spsc_queue_t<piped_entry_t>* out)
+{
+    // the worker's lifetime in the trace; --stats counts only the
+    // name_stat() calls, not the waits on the queues
+    phase_timer_t timer(PHASE_META, PHASE_TRACED);
+    piped_entry_t e;
+    while (in->pop(e)) {
+        name_stat(dirfd, e.name, e.st);
+        out->push(e);
+    }
+    out->close();
+}
+
+void pipeline_read(dir_reader_t& reader, entry_table_t& table, const ls_attr_t& attr,
+                   long_widths_t& widths)
+{
+    int n = attr.threads;
+    std::vector<spsc_queue_t<piped_entry_t>*> in(n), out(n);
+    for (int k = 0; k < n; ++k) {
+        in[k] = new spsc_queue_t<piped_entry_t>(queue_capacity);
+        out[k] = new spsc_queue_t<piped_entry_t>(queue_capacity);
+    }
+
+    name_windows_t names;
+    names.arenas = &table.names;
+    names.window = 0;
+    names.done = 0;
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(read_stage, std::ref(reader), std::ref(names), std::cref(attr),
+                                  std::ref(in)));
+    for (int k = 0; k < n; ++k)
+        threads.push_back(std::thread(stat_stage, table.dirfd, in[k], out[k]));
+
+    // format stage: the -l width pass runs here while the workers are
+    // still waiting on the filesystem for later entries
+    bool long_format = attr.long_format || attr.l_without_owner;
+    piped_entry_t e;
+    for (std::size_t i = 0; out[i % n]->pop(e); ++i) {
+        std::size_t j = table.add_interned(e.name, e.len, e.d_type);
+        table.set_stat(j, e.st);
+        if (long_format)
+            measure_long(table, j, widths);
+    }
+
+    for (std::size_t k = 0; k < threads.size(); ++k)
+        threads[k].join();
+    for (int k = 0; k < n; ++k) {
+        delete in[k];
+        delete out[k];
+    }
+}
+
+struct stream_pipeline_t::state_t {
+    std::vector<spsc_queue_t<piped_entry_t>*> in, out;
+    std::vector<std::thread> threads;
+    name_arena_t arenas[2];
+    name_windows_t names;
+    std::size_t next;
+    piped_entry_t pending;
+};
+
+stream_pipeline_t::stream_pipeline_t(dir_reader_t& reader, int dirfd, const ls_attr_t& attr,
+                                     std::size_t window)
+    : s(new state_t)
+{
+    int n = attr.threads;
+    s->in.resize(n);
+    s->out.resize(n);
+    for (int k = 0; k < n; ++k) {
+        s->in[k] = new spsc_queue_t<piped_entry_t>(queue_capacity);
+        s->out[k] = new spsc_queue_t<piped_entry_t>(queue_capacity);
+    }
+    s->names.arenas = s->arenas;
+    s->names.window = window;
+    s->names.done = 0;
+    s->next = 0;
+    s->threads.push_back(std::thread(read_stage, std::ref(reader), std::ref(s->names), std::cref(attr),
+                                     std::ref(s->in)));
+    for (int k = 0; k < n; ++k)
+        s->threads.push_back(std::thread(stat_stage, dirfd, s->in[k], s->out[k]));
+}
+
+stream_pipeline_t::~stream_pipeline_t()
+{
+    for (std::size_t k = 0; k < s->threads.size(); ++k)
+        s->threads[k].join();
+    for (std::size_t k = 0; k < s->in.size(); ++k) {
+        delete s->in[k];
+        delete s->out[k];
+    }
+    delete s;
+}
+
+// false once the directory is done
+bool stream_pipeline_t::next()
+{
+    if (!s->out[s->next % s->out.size()]->pop(s->pending))
+        return false;
+    ++s->next;
+    return true;
+}
+
+// the entry next() waited for; its index in table
+std::size_t stream_pipeline_t::add(entry_table_t& table)
+{
+    const piped_entry_t& e = s->pending;
+    std::size_t i = table.add_interned(e.name, e.len, e.d_type);
+    table.set_stat(i, e.st);
+    return i;
+}
+
+void stream_pipeline_t::window_done()
+{
+    std::lock_guard<std::mutex> guard(s->names.lock);
+    ++s->names.done;
+    s->names.cv.notify_one();
+}
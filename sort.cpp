@@ -0,0 +1,145 @@
+#include "ls.hpp"
+
+// Sorting a listing. Every entry's key is extracted once into a compact
+// (key, index) array: the size or mtime for the numeric orders, the first
+// eight bytes of the name or extension for the textual ones. That array is
+// radix sorted, then a single pass orders each run of equal keys with the
+// full comparison (rest of the name, nanoseconds, ...). The result is the
+// table's order; no entry moves, and only the columns the order needs are
+// read.
+
+struct sort_item_t {
+    unsigned long long key;
+    unsigned int index;
+};
+
+// below this many entries a comparison sort of the keys is cheaper than
+// eight counting passes
+static const std::size_t radix_min = 256;
+
+// the first eight bytes, big-endian, so that comparing keys compares the
+// strings; names cannot contain a NUL, so the zero padding sorts first
+static unsigned long long prefix_key(const char* s, std::size_t len)
+{
+    unsigned long long k = 0;
+    for (std::size_t i = 0; i < 8; ++i)
+        k = k << 8 | (i < len ? static_cast<unsigned char>(s[i]) : 0);
+    return k;
+}
+
+// -X: what follows the last '.', empty if there is none
+static const char* extension(const char* name)
+{
+    const char* dot = std::strrchr(name, '.');
+    return dot ? dot + 1 : "";
+}
+
+static unsigned long long extract_key(const entry_table_t& t, std::size_t i, int order)
+{
+    switch (order) {
+    case SORT_SIZE: // largest first
+        return ~static_cast<unsigned long long>(t.bytes[i]);
+    case SORT_TIME: { // newest first; flip the sign bit to order signed seconds
+        unsigned long long sec = t.mtime[i].tv_sec;
+        return ~(sec ^ 1ULL << 63);
+    }
+    case SORT_EXTENSION: {
+        const char* ext = extension(t.name[i]);
+        return prefix_key(ext, std::strlen(ext));
+    }
+    case SORT_VERSION: // no useful prefix; the tie pass does all the work
+        return 0;
+    default:
+        return prefix_key(t.name[i], t.name_len[i]);
+    }
+}
+
+// orders entries whose keys are equal
+struct tie_cmp_t {
+    const entry_table_t& t;
+    int order;
+
+    bool operator()(const sort_item_t& x, const sort_item_t& y) const {
+        const char* a = t.name[x.index];
+        const char* b = t.name[y.index];
+        switch (order) {
+        case SORT_TIME:
+            if (t.mtime[x.index].tv_nsec != t.mtime[y.index].tv_nsec)
+                return t.mtime[x.index].tv_nsec > t.mtime[y.index].tv_nsec;
+            break;
+        case SORT_EXTENSION: {
+            int c = std::strcmp(extension(a), extension(b));
+            if (c != 0)
+                return c < 0;
+            break;
+        }
+        case SORT_VERSION:
+            return strverscmp(a, b) < 0;
+        }
+        // the same order std::string's operator< gives
+        return std::strcmp(a, b) < 0;
+    }
+};
+
+static bool key_less(const sort_item_t& a, const sort_item_t& b)
+{
+    return a.key < b.key;
+}
+
+// LSD radix sort on the 64-bit keys, a byte per pass; passes where every
+// key has the same byte are skipped
+static void radix_sort(std::vector<sort_item_t>& items)
+{
+    if (items.size() < radix_min) {
+        std::sort(items.begin(), items.end(), key_less);
+        return;
+    }
+    std::vector<sort_item_t> tmp(items.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::size_t count[256] = {0};
+        for (std::size_t i = 0; i < items.size(); ++i)
+            ++count[items[i].key >> shift & 0xff];
+        if (count[items[0].key >> shift & 0xff] == items.size())
+            continue;
+
+        std::size_t pos = 0;
+        for (int b = 0; b < 256; ++b) {
+            std::size_t c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for (std::size_t i = 0; i < items.size(); ++i)
+            tmp[count[items[i].key >> shift & 0xff]++] = items[i];
+        items.swap(tmp);
+    }
+}
+
+void sort_entries(entry_table_t& files, const ls_attr_t& attr)
+{
+    phase_timer_t timer(PHASE_SORT);
+    if (!attr.no_sort && files.size() > 1) {
+        // stat everything up front so no key extraction waits on the disk
+        if (attr.sort == SORT_SIZE || attr.sort == SORT_TIME)
+            fill_stats(files);
+
+        std::vector<sort_item_t> items(files.size());
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            items[i].key = extract_key(files, i, attr.sort);
+            items[i].index = i;
+        }
+        radix_sort(items);
+
+        tie_cmp_t tie = {files, attr.sort};
+        for (std::size_t i = 0, j; i < items.size(); i = j) {
+            for (j = i + 1; j < items.size() && items[j].key == items[i].key; ++j)
+                ;
+            if (j - i > 1)
+                std::sort(items.begin() + i, items.begin() + j, tie);
+        }
+
+        for (std::size_t i = 0; i < items.size(); ++i)
+            files.order[i] = items[i].index;
+    }
+    if (attr.reverse)
+        std::reverse(files.order.begin(), files.order.end());
+}
@@ -0,0 +1,80 @@
+#include "ls.hpp"
+
+bool stats_enabled = false;
+std::atomic<unsigned long> stats_counters[STATS_COUNTERS];
+
+static std::atomic<long long> phase_ns[PHASE_COUNT];
+static long long run_start;
+static bool with_cache = false;
+
+// the innermost running timer of this thread
+static thread_local phase_timer_t* current_timer = NULL;
+
+void phase_timer_t::enter()
+{
+    start = monotonic_ns();
+    if (trace_enabled && (how & PHASE_TRACED))
+        trace_phase('B', phase, start);
+    if (!(how & PHASE_TIMED))
+        return;
+    parent = current_timer;
+    if (parent)
+        phase_ns[parent->phase].fetch_add(start - parent->start, std::memory_order_relaxed);
+    current_timer = this;
+}
+
+void phase_timer_t::leave()
+{
+    long long now = monotonic_ns();
+    if (how & PHASE_TIMED) {
+        phase_ns[phase].fetch_add(now - start, std::memory_order_relaxed);
+        current_timer = parent;
+        if (parent)
+            parent->start = now;
+    }
+    if (trace_enabled && (how & PHASE_TRACED))
+        trace_phase('E', phase, now);
+}
+
+void stats_init(const ls_attr_t& attr)
+{
+    stats_enabled = attr.stats;
+    with_cache = attr.cache;
+    run_start = monotonic_ns();
+}
+
+static unsigned long counter(int c)
+{
+    return stats_counters[c].load();
+}
+
+static double ms(long long ns)
+{
+    return ns / 1e6;
+}
+
+// three lines on stderr, after everything on stdout has gone out
+void stats_report()
+{
+    if (!stats_enabled)
+        return;
+    stdout_writer.flush();
+    long long wall = monotonic_ns() - run_start;
+
+    std::fprintf(stderr, "stats: statx %lu, fstat %lu, getdents64 %lu, open %lu, io_uring_enter %lu, "
+                 "write %lu, nss %lu\n", counter(STATS_STATX), counter(STATS_FSTAT), counter(STATS_GETDENTS),
+                 counter(STATS_OPEN_DIR), counter(STATS_URING_ENTER), counter(STATS_WRITE), counter(STATS_NSS));
+    std::fprintf(stderr, "stats: read %lu bytes in %lu dirents, %lu entries, wrote %lu bytes, "
+                 "allocated %lu bytes in %lu blocks", counter(STATS_DIRENT_BYTES), counter(STATS_DIRENTS),
+                 counter(STATS_ENTRIES), counter(STATS_WRITE_BYTES), counter(STATS_ALLOC_BYTES),
+                 counter(STATS_ALLOCS));
+    if (with_cache) {
+        unsigned long hit, miss, stored;
+        cache_counters(hit, miss, stored);
+        std::fprintf(stderr, ", cache %lu hits %lu misses %lu stored", hit, miss, stored);
+    }
+    std::fprintf(stderr, "\nstats: ms read %.2f, metadata %.2f, sort %.2f, layout %.2f, format %.2f, "
+                 "output %.2f, wall %.2f\n", ms(phase_ns[PHASE_READ]), ms(phase_ns[PHASE_META]),
+                 ms(phase_ns[PHASE_SORT]), ms(phase_ns[PHASE_LAYOUT]), ms(phase_ns[PHASE_FORMAT]),
+                 ms(phase_ns[PHASE_OUTPUT]), ms(wall));
+}
@@ -0,0 +1,175 @@
+#include "ls.hpp"
+
+name_arena_t::name_arena_t()
+    : cur(0), used(0)
+{
+}
+
+name_arena_t::~name_arena_t()
+{
+    reset();
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+        delete[] chunks[i];
+}
+
+const char* name_arena_t::add(const char* s, std::size_t len)
+{
+    char* p;
+    if (len + 1 > chunk_size) {
+        // command line operands can be paths of any length
+        p = new char[len + 1];
+        oversized.push_back(p);
+        stats_count(STATS_ALLOCS);
+        stats_count(STATS_ALLOC_BYTES, len + 1);
+    } else {
+        if (chunks.empty() || used + len + 1 > chunk_size) {
+            if (!chunks.empty())
+                ++cur;
+            if (cur == chunks.size()) {
+                chunks.push_back(new char[chunk_size]);
+                stats_count(STATS_ALLOCS);
+                stats_count(STATS_ALLOC_BYTES, chunk_size);
+            }
+            used = 0;
+        }
+        p = chunks[cur] + used;
+        used += len + 1;
+    }
+    std::memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void name_arena_t::reset()
+{
+    for (std::size_t i = 0; i < oversized.size(); ++i)
+        delete[] oversized[i];
+    oversized.clear();
+    cur = used = 0;
+}
+
+std::size_t entry_table_t::add(const char* s, std::size_t len, unsigned char type)
+{
+    return add_interned(names.add(s, len), len, type);
+}
+
+// s already lives in this table's arena
+std::size_t entry_table_t::add_interned(const char* s, std::size_t len, unsigned char type)
+{
+    std::size_t i = name.size();
+    name.push_back(s);
+    name_len.push_back(len);
+    d_type.push_back(type);
+    has_stat.push_back(false);
+    order.push_back(i);
+    return i;
+}
+
+// append entry i of another table (both must share a dirfd)
+void entry_table_t::add_row(const entry_table_t& from, std::size_t i)
+{
+    std::size_t j = add(from.name[i], from.name_len[i], from.d_type[i]);
+    if (from.has_stat[i]) {
+        struct stat st;
+        st.st_mode = from.mode[i];
+        st.st_nlink = from.nlink[i];
+        st.st_uid = from.uid[i];
+        st.st_gid = from.gid[i];
+        st.st_size = from.bytes[i];
+        st.st_blocks = from.blocks[i];
+        st.st_mtim = from.mtime[i];
+        st.st_atim = from.atime[i];
+        st.st_ctim = from.ctime[i];
+        st.st_ino = from.ino[i];
+        st.st_dev = from.dev[i];
+        set_stat(j, st);
+    }
+}
+
+void entry_table_t::set_stat(std::size_t i, const struct stat& st)
+{
+    if (mode.size() < name.size()) {
+        std::size_t n = name.size();
+        mode.resize(n);
+        nlink.resize(n);
+        uid.resize(n);
+        gid.resize(n);
+        bytes.resize(n);
+        blocks.resize(n);
+        mtime.resize(n);
+        atime.resize(n);
+        ctime.resize(n);
+        ino.resize(n);
+        dev.resize(n);
+    }
+    mode[i] = st.st_mode;
+    nlink[i] = st.st_nlink;
+    uid[i] = st.st_uid;
+    gid[i] = st.st_gid;
+    bytes[i] = st.st_size;
+    blocks[i] = st.st_blocks;
+    mtime[i] = st.st_mtim;
+    atime[i] = st.st_atim;
+    ctime[i] = st.st_ctim;
+    ino[i] = st.st_ino;
+    dev[i] = st.st_dev;
+    has_stat[i] = true;
+}
+
+template <typename T>
+static void keep_column(std::vector<T>& v, const std::vector<unsigned char>& keep)
+{
+    // the stat columns may stop short of the last rows
+    std::size_t j = 0;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (keep[i])
+            v[j++] = v[i];
+    }
+    v.resize(j);
+}
+
+// drop every row i with keep[i] unset; the names stay in the arena. Meant
+// for before sort_entries(): the order starts over as insertion order.
+void entry_table_t::keep(const std::vector<unsigned char>& rows)
+{
+    keep_column(name, rows);
+    keep_column(name_len, rows);
+    keep_column(d_type, rows);
+    keep_column(has_stat, rows);
+    keep_column(mode, rows);
+    keep_column(nlink, rows);
+    keep_column(uid, rows);
+    keep_column(gid, rows);
+    keep_column(bytes, rows);
+    keep_column(blocks, rows);
+    keep_column(mtime, rows);
+    keep_column(atime, rows);
+    keep_column(ctime, rows);
+    keep_column(ino, rows);
+    keep_column(dev, rows);
+    order.resize(name.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+}
+
+// ready for the next directory; capacity and arena chunks are kept
+void entry_table_t::clear()
+{
+    names.reset();
+    name.clear();
+    name_len.clear();
+    d_type.clear();
+    has_stat.clear();
+    mode.clear();
+    nlink.clear();
+    uid.clear();
+    gid.clear();
+    bytes.clear();
+    blocks.clear();
+    mtime.clear();
+    atime.clear();
+    ctime.clear();
+    ino.clear();
+    dev.clear();
+    order.clear();
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# The --cache half of `make check`: saves a listing, damages the saved
+# file in the ways a corrupt or hostile shared cache directory could, and
+# checks that every run still prints what an uncached run prints instead
+# of reading past the file.
+#
+# The offsets below follow cache_header_t and cache_entry_t in cache.cpp
+# (x86-64 layout: an 80 byte header, then 112 byte entries with name_off
+# at 100); update them together.
+
+LS=${LS:-./ls}
+
+if [ ! -x "$LS" ]; then
+    echo "$LS not found, run make check" >&2
+    exit 1
+fi
+
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+mkdir "$OUT/tree" "$OUT/cache"
+for i in 1 2 3 4 5 6 7 8; do
+    echo "$i" > "$OUT/tree/file$i"
+done
+mkdir "$OUT/tree/sub"
+# a directory changed within the last second is never saved
+touch -d 2020-01-01 "$OUT/tree"
+
+"$LS" -l "$OUT/tree" > "$OUT/want" || exit 1
+"$LS" -l --cache="$OUT/cache" "$OUT/tree" > /dev/null || exit 1
+saved=$(ls "$OUT/cache"/* 2>/dev/null | head -1)
+if [ -z "$saved" ]; then
+    echo "FAIL no listing was saved" >&2
+    exit 1
+fi
+cp "$saved" "$OUT/good"
+failed=0
+
+# poke OFFSET BYTES: overwrite the saved listing at OFFSET with BYTES
+# (printf escapes), starting again from the good copy
+poke() {
+    cp "$OUT/good" "$saved"
+    printf "$2" | dd of="$saved" bs=1 seek="$1" conv=notrunc 2> /dev/null
+}
+
+# check NAME: the cached run must succeed and match the uncached one
+check() {
+    "$LS" -l --cache="$OUT/cache" "$OUT/tree" > "$OUT/got" 2> "$OUT/err"
+    rc=$?
+    if [ $rc -ne 0 ] || ! cmp -s "$OUT/want" "$OUT/got"; then
+        echo "FAIL $1 (exit $rc)" >&2
+        diff -u "$OUT/want" "$OUT/got" | head -20 >&2
+        failed=1
+    else
+        echo "ok   $1"
+    fi
+}
+
+check cache_intact
+poke 180 '\377\377\377\377\002\000\000\000'
+check cache_name_off_wraps
+poke 184 '\377\377\377\377'
+check cache_name_len_huge
+poke 72 '\360\377\377\377\377\377\377\377'
+check cache_names_size_huge
+poke 20 '\377\377\377\377'
+check cache_count_huge
+cp "$OUT/good" "$saved"
+truncate -s 100 "$saved"
+check cache_truncated
+exit $failed
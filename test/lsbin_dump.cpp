@@ -0,0 +1,140 @@
+// Prints a --format=binary stream as text, using nothing but lsbin.hpp, so
+// test/roundtrip.sh can hold it against what ls itself prints:
+//
+//   test/lsbin_dump -l FILE   each record as a line of
+//                             ls -ln --time-style=full-iso, each
+//                             LSBIN_DIR as its "PATH:" header
+//   test/lsbin_dump -j FILE   each record as
+//                             TYPE MODE SIZE BLOCKS NLINK UID GID INO
+//                             ATIME_NS MTIME_NS CTIME_NS NAME,
+//                             each LSBIN_DIR as "dir PATH": the fields
+//                             of --format=json, in its order
+//
+// Columns are separated by single spaces; the caller squeezes the padding
+// out of ls's own output before comparing.
+
+#include "../lsbin.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* type_name(uint32_t mode)
+{
+    if (S_ISREG(mode))
+        return "file";
+    if (S_ISDIR(mode))
+        return "dir";
+    if (S_ISLNK(mode))
+        return "symlink";
+    if (S_ISCHR(mode))
+        return "char";
+    if (S_ISBLK(mode))
+        return "block";
+    if (S_ISFIFO(mode))
+        return "fifo";
+    if (S_ISSOCK(mode))
+        return "socket";
+    return "unknown";
+}
+
+// the mode column of ls -l, as ls.cpp spells it
+static void put_mode(uint32_t m)
+{
+    char s[11];
+    s[0] = S_ISLNK(m) ? 'l' : S_ISREG(m) ? '-' : S_ISDIR(m) ? 'd' : S_ISCHR(m) ? 'c' :
+           S_ISBLK(m) ? 'b' : S_ISFIFO(m) ? 'f' : '?';
+    const char* rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; ++i)
+        s[1 + i] = m & (0400 >> i) ? rwx[i] : '-';
+    s[10] = '\0';
+    std::fputs(s, stdout);
+}
+
+// "2026-10-18 04:57:49.123456789 +0000"
+static void put_full_iso(int64_t ns)
+{
+    time_t sec = ns / 1000000000;
+    long nsec = ns % 1000000000;
+    if (nsec < 0) {
+        --sec;
+        nsec += 1000000000;
+    }
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char date[32], zone[8];
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    std::strftime(zone, sizeof(zone), "%z", &tm);
+    std::printf("%s.%09ld %s", date, nsec, zone);
+}
+
+static void dump_long(const lsbin_record_t& r, const char* name)
+{
+    put_mode(r.mode);
+    std::printf(" %llu %u %u %llu ", static_cast<unsigned long long>(r.nlink), r.uid, r.gid,
+                static_cast<unsigned long long>(r.size));
+    put_full_iso(r.mtime_ns);
+    std::printf(" %.*s\n", static_cast<int>(r.name_len), name);
+}
+
+static void dump_fields(const lsbin_record_t& r, const char* name)
+{
+    std::printf("%s %u %llu %llu %llu %u %u %llu %lld %lld %lld %.*s\n", type_name(r.mode), r.mode & 07777,
+                static_cast<unsigned long long>(r.size), static_cast<unsigned long long>(r.blocks),
+                static_cast<unsigned long long>(r.nlink), r.uid, r.gid, static_cast<unsigned long long>(r.ino),
+                static_cast<long long>(r.atime_ns), static_cast<long long>(r.mtime_ns),
+                static_cast<long long>(r.ctime_ns), static_cast<int>(r.name_len), name);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3 || (std::strcmp(argv[1], "-l") != 0 && std::strcmp(argv[1], "-j") != 0)) {
+        std::fprintf(stderr, "usage: lsbin_dump -l|-j FILE\n");
+        return 1;
+    }
+    bool long_format = argv[1][1] == 'l';
+
+    int fd = open(argv[2], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        std::perror(argv[2]);
+        return 1;
+    }
+    void* map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    lsbin_reader_t r;
+    if (map == MAP_FAILED || !lsbin_open(r, map, st.st_size)) {
+        std::fprintf(stderr, "lsbin_dump: %s is not an lsbin stream\n", argv[2]);
+        return 1;
+    }
+
+    lsbin_segment_view_t seg;
+    while (lsbin_next(r, seg)) {
+        if (seg.kind == LSBIN_DIR) {
+            if (long_format)
+                std::printf("%.*s:\n", static_cast<int>(seg.names_size), seg.names);
+            else
+                std::printf("dir %.*s\n", static_cast<int>(seg.names_size), seg.names);
+            continue;
+        }
+        for (uint32_t i = 0; i < seg.count; ++i) {
+            const char* name = lsbin_name(seg, seg.records[i]);
+            if (name == NULL) {
+                std::fprintf(stderr, "lsbin_dump: record %u names outside its heap\n", i);
+                return 1;
+            }
+            if (long_format)
+                dump_long(seg.records[i], name);
+            else
+                dump_fields(seg.records[i], name);
+        }
+    }
+    if (r.pos != r.end) {
+        std::fprintf(stderr, "lsbin_dump: %s ends in a truncated segment\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+# The check behind `make check`: lists generated trees with
+# --format=binary, prints the stream back with test/lsbin_dump, and
+# compares the result with what the same ls prints as -ln and as
+# --format=json. Any difference is shown as a diff and fails the check.
+#
+# DIR defaults to $TMPDIR/ls-roundtrip; the trees are built there with
+# bench/gen_tree once and kept for later runs.
+
+LS=${LS:-./ls}
+DUMP=test/lsbin_dump
+DIR=${DIR:-${TMPDIR:-/tmp}/ls-roundtrip}
+
+for tool in "$LS" "$DUMP" bench/gen_tree; do
+    if [ ! -x "$tool" ]; then
+        echo "$tool not found, run make check" >&2
+        exit 1
+    fi
+done
+mkdir -p "$DIR" || exit 1
+
+# tree NAME KIND COUNT, as in bench/run.sh
+tree() {
+    if [ "$(cat "$DIR/$1/.gen_tree" 2>/dev/null | cut -d' ' -f1,2)" != "$2 $3" ]; then
+        rm -rf "${DIR:?}/$1"
+        bench/gen_tree "$2" "$3" "$DIR/$1" || exit 1
+    fi
+}
+tree mixed mixed 2000
+tree deep deep 4
+
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+failed=0
+
+# compare NAME: diff $OUT/NAME.want against $OUT/NAME.got
+compare() {
+    if ! diff -u "$OUT/$1.want" "$OUT/$1.got" > "$OUT/$1.diff"; then
+        echo "FAIL $1" >&2
+        head -40 "$OUT/$1.diff" >&2
+        failed=1
+    else
+        echo "ok   $1"
+    fi
+}
+
+# long NAME ARG...: -ln against the dump of the binary stream
+long() {
+    n=$1
+    shift
+    "$LS" -ln --time-style=full-iso "$@" | grep -v '^total ' | grep -v '^$' | tr -s ' ' > "$OUT/$n.want"
+    "$LS" --format=binary "$@" > "$OUT/$n.bin" && "$DUMP" -l "$OUT/$n.bin" > "$OUT/$n.got"
+    compare "$n"
+}
+
+# json NAME ARG...: --format=json, reduced to lsbin_dump -j's fields,
+# against the dump of the binary stream
+json() {
+    n=$1
+    shift
+    "$LS" --format=json "$@" | sed -E \
+        -e 's/^\{"dir":"(.*)"\}$/dir \1/' \
+        -e 's/,"[a-z_]+":(-?[0-9]+)/ \1/g' \
+        -e 's/^\{"name":"(.*)","type":"([a-z]+)"(.*)\}$/\2\3 \1/' > "$OUT/$n.want"
+    "$LS" --format=binary "$@" > "$OUT/$n.bin" && "$DUMP" -j "$OUT/$n.bin" > "$OUT/$n.got"
+    compare "$n"
+}
+
+long l_mixed "$DIR/mixed"
+long lS_mixed -S "$DIR/mixed"
+long lR_deep -R "$DIR/deep"
+json json_mixed "$DIR/mixed"
+json json_f_mixed -f "$DIR/mixed"
+json json_R_deep -R "$DIR/deep"
+json json_operands "$DIR/deep/dir0" "$DIR/deep/dir1" "$DIR/mixed/.gen_tree"
+json json_R_operands -R "$DIR/deep/dir0" "$DIR/mixed/.gen_tree"
+exit $failed
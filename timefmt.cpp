@@ -0,0 +1,209 @@
+#include "ls.hpp"
+
+// -l timestamps without ctime(). The timezone is loaded once, up front;
+// after that a timestamp costs at most one localtime_r per calendar day
+// a thread has not seen yet, and nothing at all when it repeats the
+// previous file's second. All the caches are per thread, so the parallel
+// -R workers can format without sharing anything.
+
+static const char* const week_days[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char* const months[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static int style = TIME_CTIME;
+
+// GNU ls calls a timestamp recent if it is no more than six months old
+// and not in the future
+static time_t now, six_months_ago;
+
+// local midnight to midnight of the last day looked up; only kept when
+// the UTC offset is the same from its first second to its last
+static thread_local time_t day_lo = 1, day_hi = 0;
+static thread_local struct tm day;
+
+// the last second formatted and its text; full-iso appends the
+// nanoseconds of every file and then that second's UTC offset
+static thread_local time_t last_sec;
+static thread_local bool have_last = false;
+static thread_local char last_text[64], zone[8];
+static thread_local std::size_t last_len;
+
+void time_init(const ls_attr_t& attr)
+{
+    style = attr.time_style;
+    tzset();
+    now = std::time(NULL);
+    six_months_ago = now - 31556952 / 2;
+}
+
+bool parse_time_style(const char* s, int& out)
+{
+    static const char* const names[] = {"ctime", "locale", "iso", "long-iso", "full-iso"};
+    for (int i = 0; i < 5; ++i) {
+        if (std::strcmp(s, names[i]) == 0) {
+            out = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void local_time(time_t t, struct tm& tm)
+{
+    if (t >= day_lo && t < day_hi) {
+        long s = t - day_lo;
+        tm = day;
+        tm.tm_hour = s / 3600;
+        tm.tm_min = s / 60 % 60;
+        tm.tm_sec = s % 60;
+        return;
+    }
+    localtime_r(&t, &tm);
+
+    time_t lo = t - (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec), last = lo + 86399;
+    struct tm a, b;
+    localtime_r(&lo, &a);
+    localtime_r(&last, &b);
+    if (a.tm_gmtoff == tm.tm_gmtoff && b.tm_gmtoff == tm.tm_gmtoff &&
+        a.tm_hour == 0 && a.tm_min == 0 && a.tm_sec == 0 &&
+        b.tm_hour == 23 && b.tm_min == 59 && b.tm_sec == 59) {
+        day = a;
+        day_lo = lo;
+        day_hi = last + 1;
+    }
+}
+
+// n as exactly width digits, zero padded
+static char* digits(char* p, long n, int width)
+{
+    for (int i = width - 1; i >= 0; --i) {
+        p[i] = '0' + n % 10;
+        n /= 10;
+    }
+    return p + width;
+}
+
+// n as "%d", padded with spaces to width
+static char* number(char* p, long n, int width)
+{
+    char tmp[24];
+    int len = 0;
+    bool neg = n < 0;
+    unsigned long u = neg ? -static_cast<unsigned long>(n) : n;
+    do {
+        tmp[len++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (neg)
+        tmp[len++] = '-';
+    for (int i = len; i < width; ++i)
+        *p++ = ' ';
+    while (len > 0)
+        *p++ = tmp[--len];
+    return p;
+}
+
+static char* name3(char* p, const char* s)
+{
+    std::memcpy(p, s, 3);
+    return p + 3;
+}
+
+static char* iso_date(char* p, const struct tm& tm)
+{
+    p = tm.tm_year + 1900 >= 0 && tm.tm_year + 1900 <= 9999 ?
+        digits(p, tm.tm_year + 1900, 4) : number(p, tm.tm_year + 1900, 0);
+    *p++ = '-';
+    p = digits(p, tm.tm_mon + 1, 2);
+    *p++ = '-';
+    return digits(p, tm.tm_mday, 2);
+}
+
+static char* hh_mm(char* p, const struct tm& tm)
+{
+    p = digits(p, tm.tm_hour, 2);
+    *p++ = ':';
+    return digits(p, tm.tm_min, 2);
+}
+
+static std::size_t format(char* text, time_t t, const struct tm& tm)
+{
+    bool recent = six_months_ago < t && t <= now;
+    char* p = text;
+    switch (style) {
+    case TIME_CTIME: // "Sun Oct 18 04:57:49 2026"
+        p = name3(p, week_days[tm.tm_wday]);
+        *p++ = ' ';
+        p = name3(p, months[tm.tm_mon]);
+        p = number(p, tm.tm_mday, 3);
+        *p++ = ' ';
+        p = hh_mm(p, tm);
+        *p++ = ':';
+        p = digits(p, tm.tm_sec, 2);
+        *p++ = ' ';
+        p = number(p, tm.tm_year + 1900L, 0);
+        break;
+    case TIME_LOCALE: // "Oct 18 04:57" or "Oct 18  2025"
+        p = name3(p, months[tm.tm_mon]);
+        p = number(p, tm.tm_mday, 3);
+        *p++ = ' ';
+        if (recent)
+            p = hh_mm(p, tm);
+        else
+            p = number(p, tm.tm_year + 1900L, 5);
+        break;
+    case TIME_ISO: // "10-18 04:57" or "2025-10-18 "
+        if (recent) {
+            p = digits(p, tm.tm_mon + 1, 2);
+            *p++ = '-';
+            p = digits(p, tm.tm_mday, 2);
+            *p++ = ' ';
+            p = hh_mm(p, tm);
+        } else {
+            p = iso_date(p, tm);
+            *p++ = ' ';
+        }
+        break;
+    case TIME_LONG_ISO: // "2026-10-18 04:57"
+        p = iso_date(p, tm);
+        *p++ = ' ';
+        p = hh_mm(p, tm);
+        break;
+    case TIME_FULL_ISO: { // "2026-10-18 04:57:49", then ".nnnnnnnnn +zzzz"
+        p = iso_date(p, tm);
+        *p++ = ' ';
+        p = hh_mm(p, tm);
+        *p++ = ':';
+        p = digits(p, tm.tm_sec, 2);
+        long off = tm.tm_gmtoff / 60;
+        zone[0] = ' ';
+        zone[1] = off < 0 ? '-' : '+';
+        off = std::labs(off);
+        digits(zone + 2, off / 60 * 100 + off % 60, 4);
+        break;
+    }
+    }
+    return p - text;
+}
+
+void put_time(writer_t& out, const struct timespec& ts)
+{
+    if (!have_last || ts.tv_sec != last_sec) {
+        struct tm tm;
+        local_time(ts.tv_sec, tm);
+        last_len = format(last_text, ts.tv_sec, tm);
+        last_sec = ts.tv_sec;
+        have_last = true;
+    }
+    out.put(last_text, last_len);
+    if (style == TIME_FULL_ISO) {
+        char nsec[10];
+        nsec[0] = '.';
+        digits(nsec + 1, ts.tv_nsec, 9);
+        out.put(nsec, sizeof(nsec));
+        out.put(zone, 6);
+    }
+}
@@ -0,0 +1,131 @@
+#include "ls.hpp"
+
+// --trace=FILE: begin/end events for every directory listed and every
+// phase_timer_t scope, in the Chrome trace event format (chrome://tracing,
+// Perfetto). Each thread appends to its own buffer without locking; the
+// buffers are only registered (under a lock, once per thread) and read
+// back after the walk, when every thread that wrote one has been joined.
+
+bool trace_enabled = false;
+
+struct trace_event_t {
+    long long ns;
+    char ph;            // 'B' or 'E'
+    int phase;          // PHASE_*, or -1 for a directory
+    std::string path;   // directories' begin events only
+};
+
+struct trace_buffer_t {
+    int tid;
+    std::vector<trace_event_t> events;
+};
+
+static std::mutex buffers_lock;
+static std::vector<trace_buffer_t*> buffers;
+static int trace_fd = -1;
+static long long trace_start;
+
+static thread_local trace_buffer_t* own_buffer = NULL;
+
+static const char* const phase_names[PHASE_COUNT] = {
+    "read", "metadata", "sort", "layout", "format", "output"
+};
+
+void trace_init(const char* file)
+{
+    if (file == NULL)
+        return;
+    trace_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+        std::fprintf(stderr, "ls: cannot open trace file '%s': %s\n", file, std::strerror(errno));
+        std::exit(1);
+    }
+    trace_enabled = true;
+    trace_start = monotonic_ns();
+}
+
+static trace_buffer_t& buffer()
+{
+    if (own_buffer == NULL) {
+        own_buffer = new trace_buffer_t;
+        own_buffer->tid = syscall(SYS_gettid);
+        std::lock_guard<std::mutex> guard(buffers_lock);
+        buffers.push_back(own_buffer);
+    }
+    return *own_buffer;
+}
+
+void trace_phase(char ph, int phase, long long ns)
+{
+    trace_event_t e = {ns, ph, phase, std::string()};
+    buffer().events.push_back(e);
+}
+
+void trace_dir_t::begin(const std::string& path)
+{
+    trace_event_t e = {monotonic_ns(), 'B', -1, path};
+    buffer().events.push_back(e);
+}
+
+void trace_dir_t::end()
+{
+    trace_event_t e = {monotonic_ns(), 'E', -1, std::string()};
+    buffer().events.push_back(e);
+}
+
+// microseconds since the run started, to the nanosecond
+static void put_us(writer_t& out, long long ns)
+{
+    ns -= trace_start;
+    out.num(ns / 1000);
+    char frac[4] = {'.', static_cast<char>('0' + ns / 100 % 10), static_cast<char>('0' + ns / 10 % 10),
+                    static_cast<char>('0' + ns % 10)};
+    out.put(frac, sizeof(frac));
+}
+
+void trace_write()
+{
+    if (!trace_enabled)
+        return;
+    // nothing below may add to the buffers being written out
+    trace_enabled = false;
+    writer_t out(trace_fd);
+    bool first = true;
+    int pid = getpid();
+
+    out.put("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    for (std::size_t b = 0; b < buffers.size(); ++b) {
+        const trace_buffer_t& buf = *buffers[b];
+        for (std::size_t i = 0; i < buf.events.size(); ++i) {
+            const trace_event_t& e = buf.events[i];
+            if (!first)
+                out.put(",\n");
+            first = false;
+            out.put("{\"ph\":\"");
+            out.put(e.ph);
+            out.put("\",\"pid\":");
+            out.num(pid);
+            out.put(",\"tid\":");
+            out.num(buf.tid);
+            out.put(",\"ts\":");
+            put_us(out, e.ns);
+            if (e.phase >= 0) {
+                out.put(",\"cat\":\"phase\",\"name\":\"");
+                out.put(phase_names[e.phase]);
+                out.put('"');
+            } else if (e.ph == 'B') {
+                // named after the path, so the viewer labels each bar
+                out.put(",\"cat\":\"dir\",\"name\":");
+                json_string(out, e.path.data(), e.path.size());
+                out.put(",\"args\":{\"path\":");
+                json_string(out, e.path.data(), e.path.size());
+                out.put('}');
+            }
+            out.put('}');
+        }
+    }
+    out.put("\n]}\n");
+    out.flush();
+    close(trace_fd);
+}
@@ -0,0 +1,139 @@
+#include "ls.hpp"
+
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+// a bare io_uring (no liburing) used for one thing only: pushing a whole
+// directory's worth of IORING_OP_STATX requests at the kernel at once
+struct uring_t {
+    int fd;
+    unsigned int entries;
+
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+};
+
+// one ring per thread, so parallel -R workers never share a submission queue
+static thread_local uring_t ring = {-1};
+static thread_local std::vector<struct statx> uring_bufs;
+
+bool uring_init(unsigned int entries)
+{
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd == -1)
+        return false;
+
+    std::size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    std::size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+
+    char* sq = static_cast<char*>(mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       fd, IORING_OFF_SQ_RING));
+    if (sq == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    char* cq = sq;
+    if (!single) {
+        cq = static_cast<char*>(mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd, IORING_OFF_CQ_RING));
+        if (cq == MAP_FAILED) {
+            munmap(sq, sq_len);
+            ::close(fd);
+            return false;
+        }
+    }
+    void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (!single)
+            munmap(cq, cq_len);
+        munmap(sq, sq_len);
+        ::close(fd);
+        return false;
+    }
+
+    ring.fd = fd;
+    ring.entries = p.sq_entries;
+    ring.sq_head = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+    ring.sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+    ring.sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+    ring.cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+    ring.cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+    ring.sqes = static_cast<struct io_uring_sqe*>(sqes);
+    ring.cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    uring_bufs.resize(ring.entries);
+    return true;
+}
+
+// stat todo[first, first + n) in one submission; entries whose request
+// fails are left alone so the synchronous path can report the error
+static void uring_batch(entry_table_t& files, const std::vector<unsigned int>& todo, std::size_t first,
+                        unsigned int n, unsigned int mask, int flags)
+{
+    unsigned int tail = *ring.sq_tail;
+    for (unsigned int i = 0; i < n; ++i) {
+        unsigned int slot = tail & *ring.sq_mask;
+        struct io_uring_sqe* sqe = &ring.sqes[slot];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = files.dirfd;
+        sqe->addr = reinterpret_cast<unsigned long>(files.name[todo[first + i]]);
+        sqe->len = mask;
+        sqe->statx_flags = flags;
+        sqe->off = reinterpret_cast<unsigned long>(&uring_bufs[i]);
+        sqe->user_data = i;
+        ring.sq_array[slot] = slot;
+        ++tail;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    stats_count(STATS_STATX, n);
+
+    unsigned int done = 0;
+    while (done < n) {
+        int submit = done == 0 ? n : 0;
+        stats_count(STATS_URING_ENTER);
+        if (syscall(__NR_io_uring_enter, ring.fd, submit, n - done, IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+            if (errno == EINTR)
+                continue;
+            std::printf("uring_batch\n");
+            std::perror("io_uring_enter");
+            std::exit(1);
+        }
+        unsigned int head = *ring.cq_head;
+        unsigned int cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head, ++done) {
+            const struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            if (cqe->res == 0) {
+                struct stat st;
+                statx_to_stat(uring_bufs[cqe->user_data], st);
+                files.set_stat(todo[first + cqe->user_data], st);
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void uring_fill_stats(entry_table_t& files, unsigned int mask, int flags)
+{
+    if (ring.fd == -1 && !uring_init(1024))
+        return;
+
+    std::vector<unsigned int> todo;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!files.has_stat[i])
+            todo.push_back(i);
+    }
+    for (std::size_t i = 0; i < todo.size(); i += ring.entries) {
+        unsigned int n = std::min<std::size_t>(ring.entries, todo.size() - i);
+        uring_batch(files, todo, i, n, mask, flags);
+    }
+}